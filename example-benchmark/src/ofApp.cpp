@@ -0,0 +1,342 @@
+#include "ofApp.h"
+
+
+void ofApp::setup()
+{
+    ofBackground(0);
+
+    loadScenes();
+    runBenchmarks();
+}
+
+
+void ofApp::draw()
+{
+    ofDrawBitmapStringHighlight(report.str(), 20, 30);
+    ofDrawBitmapStringHighlight("Press SPACE to run again.", 20, ofGetHeight() - 20);
+}
+
+
+void ofApp::keyPressed(int key)
+{
+    if (key == ' ')
+    {
+        runBenchmarks();
+    }
+}
+
+
+void ofApp::loadScenes()
+{
+    const std::size_t numPixels = 512 * 424;
+
+    std::vector<std::pair<std::string, ofProtonectSyntheticDevice::Scene>> synthetic =
+    {
+        { "plane", ofProtonectSyntheticDevice::Scene::PLANE },
+        { "spheres", ofProtonectSyntheticDevice::Scene::SPHERES },
+        { "moving boxes", ofProtonectSyntheticDevice::Scene::MOVING_BOXES }
+    };
+
+    libfreenect2::Frame depth(512, 424, 4);
+    libfreenect2::Frame ir(512, 424, 4);
+
+    for (const auto& entry: synthetic)
+    {
+        ofProtonectSyntheticDevice device(entry.second, 0);
+
+        Scene scene;
+        scene.name = "synthetic " + entry.first;
+        scene.irParams = device.getIrCameraParams();
+        scene.colorParams = device.getColorCameraParams();
+
+        for (std::size_t i = 0; i < numFrames; i++)
+        {
+            device.renderDepth(i, &depth, &ir);
+
+            const float* depthData = reinterpret_cast<const float*>(depth.data);
+            const float* irData = reinterpret_cast<const float*>(ir.data);
+
+            scene.depth.emplace_back(depthData, depthData + numPixels);
+            scene.ir.emplace_back(irData, irData + numPixels);
+        }
+
+        scenes.push_back(scene);
+    }
+
+    ofProtonectFrameFileReader recording;
+
+    if (ofFile::doesFileExist("recording.frames") && recording.load(ofToDataPath("recording.frames", true)))
+    {
+        Scene scene;
+        scene.name = "recording";
+        scene.irParams = recording.getIrCameraParams();
+        scene.colorParams = recording.getColorCameraParams();
+
+        for (std::size_t i = 0; i < std::min(numFrames, recording.getNumFrames()); i++)
+        {
+            const float* depthData = recording.getDepth(i);
+            const float* irData = recording.getIr(i);
+
+            if (depthData)
+            {
+                scene.depth.emplace_back(depthData, depthData + numPixels);
+            }
+
+            if (irData)
+            {
+                scene.ir.emplace_back(irData, irData + numPixels);
+            }
+        }
+
+        scenes.push_back(scene);
+    }
+    else
+    {
+        ofLogNotice("ofApp::loadScenes") << "no bin/data/recording.frames, only synthetic scenes are measured";
+    }
+}
+
+
+void ofApp::runBenchmarks()
+{
+    report.str("");
+
+    for (const Scene& scene: scenes)
+    {
+        report << scene.name << std::endl;
+
+        benchmarkDepthCodec(scene);
+        benchmarkPointCloud(scene);
+
+        report << std::endl;
+    }
+
+    checkFramePool();
+
+    ofLogNotice("ofApp::runBenchmarks") << std::endl << report.str();
+}
+
+
+void ofApp::benchmarkDepthCodec(const Scene& scene)
+{
+    std::vector<unsigned char> encoded;
+    std::vector<float> decoded;
+
+    auto measure = [&](const std::string& name, const std::vector<std::vector<float>>& frames)
+    {
+        if (frames.empty())
+        {
+            return;
+        }
+
+        uint64_t encodeTime = 0;
+        uint64_t decodeTime = 0;
+        std::size_t rawSize = 0;
+        std::size_t encodedSize = 0;
+        bool roundTrip = true;
+
+        for (const std::vector<float>& frame: frames)
+        {
+            decoded.resize(frame.size());
+
+            uint64_t startTime = ofProtonectTimings::now();
+            encodedSize += ofProtonectDepthCodec::encode(frame.data(), frame.size(), encoded);
+            encodeTime += ofProtonectTimings::now() - startTime;
+
+            startTime = ofProtonectTimings::now();
+            roundTrip &= ofProtonectDepthCodec::decode(encoded.data(), encoded.size(), decoded.data(), decoded.size());
+            decodeTime += ofProtonectTimings::now() - startTime;
+
+            rawSize += frame.size() * sizeof(float);
+
+            // Lossless up to rounding to whole units.
+            for (std::size_t i = 0; i < frame.size() && roundTrip; i++)
+            {
+                float expected = frame[i] >= 0.5f && frame[i] < 65535.5f ? std::floor(frame[i] + 0.5f) : 0;
+                roundTrip = decoded[i] == expected;
+            }
+        }
+
+        // Bytes per nanosecond is GB/s.
+        double encodeMBs = rawSize * 1000.0 / encodeTime;
+        double decodeMBs = rawSize * 1000.0 / decodeTime;
+
+        report << "  codec " << name
+               << ": ratio " << ofToString(double(rawSize) / encodedSize, 2)
+               << ", encode " << ofToString(encodeTime / 1000000.0 / frames.size(), 3) << " ms/frame " << ofToString(encodeMBs, 0) << " MB/s"
+               << ", decode " << ofToString(decodeTime / 1000000.0 / frames.size(), 3) << " ms/frame " << ofToString(decodeMBs, 0) << " MB/s"
+               << (roundTrip ? "" : ", ROUND TRIP FAILED") << std::endl;
+    };
+
+    measure("depth", scene.depth);
+    measure("ir   ", scene.ir);
+}
+
+
+void ofApp::benchmarkPointCloud(const Scene& scene)
+{
+    if (scene.depth.empty())
+    {
+        return;
+    }
+
+    libfreenect2::Registration registration(scene.irParams, scene.colorParams);
+    libfreenect2::Frame depth(512, 424, 4);
+    libfreenect2::Frame undistorted(512, 424, 4);
+    libfreenect2::Frame registered(512, 424, 4);
+
+    std::memset(registered.data, 0, 512 * 424 * 4);
+
+    ofProtonectPointCloudKernel kernel;
+    kernel.setup(scene.irParams);
+
+    std::vector<glm::vec3> expected;
+    std::vector<ofDefaultColorType> expectedColors;
+    std::vector<glm::vec3> vertices(512 * 424);
+    std::vector<ofDefaultColorType> colors(512 * 424);
+
+    std::vector<glm::vec3> transformed(512 * 424);
+
+    // A sensor placed in a merged multi Kinect scene.
+    ofMatrix4x4 transform;
+    transform.rotate(30, 0, 1, 0);
+    transform.translate(1200, -300, 2500);
+
+    uint64_t registrationTime = 0;
+    uint64_t kernelTime = 0;
+    uint64_t transformTime = 0;
+    uint64_t fusedTime = 0;
+    bool identical = true;
+    float maxError = 0;
+
+    for (const std::vector<float>& frame: scene.depth)
+    {
+        std::memcpy(depth.data, frame.data(), 512 * 424 * 4);
+        registration.undistortDepth(&depth, &undistorted);
+
+        // The loop ofProtonect used before.
+        uint64_t startTime = ofProtonectTimings::now();
+
+        expected.clear();
+        expectedColors.clear();
+
+        for (std::size_t y = 0; y < 424; y++)
+        {
+            for (std::size_t x = 0; x < 512; x++)
+            {
+                glm::vec3 position;
+                float rgb;
+                registration.getPointXYZRGB(&undistorted, &registered, y, x, position.x, position.y, position.z, rgb);
+                const uint8_t* p = reinterpret_cast<uint8_t*>(&rgb);
+                expected.push_back(glm::vec3(position.x * 1000, position.y * -1000, position.z * -1000));
+                expectedColors.push_back(ofColor(p[2], p[1], p[0], 255));
+            }
+        }
+
+        registrationTime += ofProtonectTimings::now() - startTime;
+
+        startTime = ofProtonectTimings::now();
+
+        const float* undistortedData = reinterpret_cast<const float*>(undistorted.data);
+        kernel.computeVertices(undistortedData, vertices.data());
+        kernel.computeColors(undistortedData, registered.data, 255, colors.data());
+
+        kernelTime += ofProtonectTimings::now() - startTime;
+
+        // Compare bits, NaN != NaN.
+        identical &= std::memcmp(expected.data(), vertices.data(), vertices.size() * sizeof(glm::vec3)) == 0;
+        identical &= std::memcmp(expectedColors.data(), colors.data(), colors.size() * sizeof(ofDefaultColorType)) == 0;
+
+        // Transforming every vertex, as ofProtonect used to.
+        startTime = ofProtonectTimings::now();
+
+        for (glm::vec3& vertex: vertices)
+        {
+            vertex = ofVec3f(vertex) * transform;
+        }
+
+        transformTime += ofProtonectTimings::now() - startTime;
+
+        startTime = ofProtonectTimings::now();
+        kernel.computeVertices(undistortedData, transform, transformed.data());
+        fusedTime += ofProtonectTimings::now() - startTime;
+
+        for (std::size_t i = 0; i < vertices.size(); i++)
+        {
+            if (!std::isnan(vertices[i].z))
+            {
+                maxError = std::max(maxError, glm::distance(vertices[i], transformed[i]));
+            }
+        }
+    }
+
+    report << "  point cloud: getPointXYZRGB " << ofToString(registrationTime / 1000000.0 / scene.depth.size(), 3) << " ms/frame"
+           << ", ray table kernel " << ofToString(kernelTime / 1000000.0 / scene.depth.size(), 3) << " ms/frame"
+           << (identical ? ", bit identical" : ", RESULTS DIFFER") << std::endl;
+
+    report << "  transform: per vertex " << ofToString(transformTime / 1000000.0 / scene.depth.size(), 3) << " ms/frame"
+           << " (after the kernel), fused SIMD " << ofToString(fusedTime / 1000000.0 / scene.depth.size(), 3) << " ms/frame"
+           << ", max difference " << ofToString(maxError, 4) << " mm" << std::endl;
+}
+
+
+void ofApp::checkFramePool()
+{
+    ofxKinectV2 kinect;
+
+    // Depth only, as fast as it can be processed.
+    if (!kinect.open(new ofProtonectSyntheticDevice(ofProtonectSyntheticDevice::Scene::PLANE, 0), false, true, true, false, false, false, false))
+    {
+        report << "frame pool: failure opening the synthetic device" << std::endl;
+        return;
+    }
+
+    // The next frame after current, nullptr if none arrives in time.
+    auto waitForNextFrame = [&kinect](const ofxKinectV2::FrameSetHandle& current)
+    {
+        uint64_t startTime = ofGetElapsedTimeMillis();
+
+        while (ofGetElapsedTimeMillis() - startTime < 2000)
+        {
+            kinect.update();
+            ofxKinectV2::FrameSetHandle frameSet = kinect.getFrameSet();
+
+            if (frameSet && frameSet != current)
+            {
+                return frameSet;
+            }
+
+            ofSleepMillis(1);
+        }
+
+        return ofxKinectV2::FrameSetHandle();
+    };
+
+    // Holding a few frames makes the pool grow. Once they are released the
+    // idle FrameSets must not keep their decoded frames, or the frame
+    // listener runs out of frames for good.
+    const std::size_t numHeld = 3;
+    const std::size_t numAfterRelease = 30;
+
+    std::vector<ofxKinectV2::FrameSetHandle> held;
+    ofxKinectV2::FrameSetHandle current;
+
+    for (std::size_t i = 0; i < numHeld && (current = waitForNextFrame(current)); i++)
+    {
+        held.push_back(current);
+    }
+
+    held.clear();
+
+    std::size_t numReceived = 0;
+
+    while (numReceived < numAfterRelease && (current = waitForNextFrame(current)))
+    {
+        numReceived++;
+    }
+
+    kinect.close();
+
+    report << "frame pool: " << numReceived << " of " << numAfterRelease << " frames after releasing " << numHeld << " held ones"
+           << (numReceived == numAfterRelease ? "" : ", FRAMES STALLED") << std::endl;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxKinectV2.h"
+#include "ofProtonectDepthCodec.h"
+
+
+/// Measures the processing stages of the addon on synthetic scenes and, if
+/// bin/data/recording.frames exists, on a recorded frame file made with
+/// ofxKinectV2::startRecording(). Results are printed and drawn.
+class ofApp: public ofBaseApp
+{
+public:
+    void setup() override;
+    void draw() override;
+
+    void keyPressed(int key) override;
+
+    /// A named sequence of depth and IR frames to run the benchmarks on.
+    struct Scene
+    {
+        std::string name;
+        libfreenect2::Freenect2Device::IrCameraParams irParams;
+        libfreenect2::Freenect2Device::ColorCameraParams colorParams;
+        std::vector<std::vector<float>> depth;
+        std::vector<std::vector<float>> ir;
+    };
+
+    void loadScenes();
+    void runBenchmarks();
+
+    void benchmarkDepthCodec(const Scene& scene);
+    void benchmarkPointCloud(const Scene& scene);
+
+    /// Checks that frames keep flowing after the app held and released
+    /// several frames.
+    void checkFramePool();
+
+    std::vector<Scene> scenes;
+    std::stringstream report;
+
+    /// The number of frames taken from each scene.
+    std::size_t numFrames = 60;
+};
@@ -32,6 +32,8 @@
 
 
 #include "ofProtonect.h"
+#include "ofProtonectFrameListener.h"
+#include "ofProtonectPacketRecorder.h"
 //#include <iostream>
 //#include <signal.h>
 #include <libfreenect2/libfreenect2.hpp>
@@ -41,8 +43,37 @@
 #include <libfreenect2/logger.h>
 #include <libfreenect2/color_settings.h>
 
-ofProtonect::ofProtonect()
+constexpr float ofProtonect::IR_PIXELS_MAX_VALUE;
+
+void ofProtonect::FrameSet::releaseFrames()
+{
+    pixels.clear();
+    registeredPixels.clear();
+    rawDepthPixels.clear();
+    rawIRPixels.clear();
+    frames.clear();
+}
+
+ofProtonect::ofProtonect():
+    enableRGB(true),
+    enableDepth(true),
+    streamsChanged(false),
+    deviceFailed(false),
+    demandDriven(false),
+    demandFrames(30),
+    frameCount(0),
+    useDepthPixels(false),
+    useIrPixels(false),
+    useDistancePixels(false),
+    waitCancelled(false)
 {
+    for (std::atomic<uint64_t>& lastRequest: lastRequests)
+    {
+        lastRequest = NEVER_REQUESTED;
+    }
+
+    setupFrameGraph();
+
     if (ofGetLogLevel() == OF_LOG_VERBOSE)
     {
         libfreenect2::setGlobalLogger(libfreenect2::createConsoleLogger(libfreenect2::Logger::Debug));
@@ -53,282 +84,1508 @@ ofProtonect::ofProtonect()
     }
 }
 
-int ofProtonect::open(const std::string& serial, PacketPipelineType packetPipelineType, int device)
+int ofProtonect::open(const std::string& serial, PacketPipelineType packetPipelineType, int device)
+{
+    pipeline = createPipeline(packetPipelineType, device);
+
+    libfreenect2::Freenect2Device* kinect = nullptr;
+
+    if (pipeline)
+    {
+        kinect = freenect2.openDevice(serial, pipeline);
+    }
+    else
+    {
+        kinect = freenect2.openDevice(serial);
+    }
+
+    if (!kinect)
+    {
+        ofLogError("ofProtonect::openKinect")  << "failure opening device with serial " << serial;
+        // libfreenect2 deleted the pipeline.
+        pipeline = nullptr;
+        return -1;
+    }
+
+    deviceSerial = serial;
+    devicePipelineType = packetPipelineType;
+    devicePipelineDevice = device;
+
+    return open(kinect);
+}
+
+libfreenect2::PacketPipeline* ofProtonect::createPipeline(PacketPipelineType packetPipelineType, int device)
+{
+    switch (packetPipelineType)
+    {
+        case PacketPipelineType::CPU:
+            return new libfreenect2::CpuPacketPipeline();
+        case PacketPipelineType::OPENGL:
+            return new libfreenect2::OpenGLPacketPipeline();
+		case PacketPipelineType::OPENCL:
+			return new libfreenect2::OpenCLPacketPipeline(device);
+		case PacketPipelineType::OPENCLKDE:
+			return new libfreenect2::OpenCLKdePacketPipeline(device);
+#if defined(LIBFREENECT2_WITH_CUDA_SUPPORT)
+		
+        case PacketPipelineType::CUDA:
+			return new libfreenect2::CudaPacketPipeline(device);
+        case PacketPipelineType::CUDAKDE:
+            return new libfreenect2::CudaKdePacketPipeline(device);
+#endif
+        case PacketPipelineType::DEFAULT:
+            break;
+    }
+
+    return nullptr;
+}
+
+int ofProtonect::openReplay(const std::string& directory, PacketPipelineType packetPipelineType, ReplayMode mode, int device)
+{
+    ofDirectory dir(directory);
+    dir.allowExt("depth");
+    dir.allowExt("jpg");
+    dir.allowExt("jpeg");
+    dir.allowExt("params");
+    dir.listDir();
+
+    std::vector<std::string> filenames;
+    std::string paramsPath;
+    bool hasColor = false;
+    bool hasDepth = false;
+
+    for (std::size_t i = 0; i < dir.size(); i++)
+    {
+        std::string path = dir.getPath(i);
+
+        if (ofFilePath::getFileExt(path) == "params")
+        {
+            paramsPath = path;
+            continue;
+        }
+
+        if (getReplayTimestamp(path) < 0)
+        {
+            continue;
+        }
+
+        if (ofFilePath::getFileExt(path) == "depth")
+        {
+            hasDepth = true;
+        }
+        else
+        {
+            hasColor = true;
+        }
+
+        filenames.push_back(path);
+    }
+
+    if (filenames.empty())
+    {
+        ofLogError("ofProtonect::openReplay") << "no recorded frames in " << directory;
+        return -1;
+    }
+
+    // Play the packets back in the order they were captured.
+    std::stable_sort(filenames.begin(), filenames.end(), [](const std::string& a, const std::string& b)
+    {
+        return getReplayTimestamp(a) < getReplayTimestamp(b);
+    });
+
+    replay.reset(new libfreenect2::Freenect2Replay());
+    pipeline = createPipeline(packetPipelineType, device);
+
+    libfreenect2::Freenect2Device* replayDevice = nullptr;
+
+    if (pipeline)
+    {
+        replayDevice = replay->openDevice(filenames, pipeline);
+    }
+    else
+    {
+        replayDevice = replay->openDevice(filenames);
+    }
+
+    if (!replayDevice)
+    {
+        ofLogError("ofProtonect::openReplay") << "failure opening replay of " << directory;
+        // libfreenect2 deleted the pipeline.
+        pipeline = nullptr;
+        replay.reset();
+        return -1;
+    }
+
+    // Registration and the point cloud use the recorded device's parameters,
+    // libfreenect2 replays with default ones otherwise. Its depth tables
+    // can't be loaded into a pipeline, those stay the default ones.
+    ofProtonectPacketRecorder::DeviceParams params;
+
+    if (!paramsPath.empty() && ofProtonectPacketRecorder::loadDeviceParams(paramsPath, params))
+    {
+        replayDevice->setIrCameraParams(params.irParams);
+        replayDevice->setColorCameraParams(params.colorParams);
+    }
+    else
+    {
+        ofLogWarning("ofProtonect::openReplay") << "no device parameters in " << directory << ", using the default ones";
+    }
+
+    // Only wait for the streams that were recorded.
+    colorAvailable = hasColor;
+    depthAvailable = hasDepth;
+
+    paceReplay = mode == ReplayMode::REALTIME;
+    replayStarted = false;
+
+    return open(replayDevice);
+}
+
+int64_t ofProtonect::getReplayTimestamp(const std::string& filename)
+{
+    // <prefix>_<timestamp>_<sequence>.<suffix>
+    std::string name = ofFilePath::getBaseName(filename);
+    std::size_t sequenceStart = name.rfind('_');
+
+    if (sequenceStart == std::string::npos || sequenceStart == 0)
+    {
+        return -1;
+    }
+
+    std::size_t timestampStart = name.rfind('_', sequenceStart - 1);
+
+    if (timestampStart == std::string::npos)
+    {
+        return -1;
+    }
+
+    std::string timestamp = name.substr(timestampStart + 1, sequenceStart - timestampStart - 1);
+
+    if (timestamp.empty() || timestamp.find_first_not_of("0123456789") != std::string::npos)
+    {
+        return -1;
+    }
+
+    return std::stoll(timestamp);
+}
+
+void ofProtonect::paceReplayFrame(const ofProtonectFrameListener::FrameMap& frames)
+{
+    const libfreenect2::Frame* frame = nullptr;
+
+    // Prefer depth, the color attached in separate queue mode may be older.
+    for (auto iter = frames.rbegin(); iter != frames.rend(); ++iter)
+    {
+        if (iter->second)
+        {
+            frame = iter->second.get();
+            break;
+        }
+    }
+
+    if (!frame)
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    if (!replayStarted)
+    {
+        replayStarted = true;
+        replayStartTimestamp = frame->timestamp;
+        replayStartTime = now;
+        return;
+    }
+
+    // Timestamps are in units of 0.125 ms.
+    uint32_t elapsed = frame->timestamp - replayStartTimestamp;
+    auto due = replayStartTime + std::chrono::microseconds(uint64_t(elapsed) * 125);
+
+    if (due > now)
+    {
+        std::this_thread::sleep_until(due);
+    }
+}
+
+int ofProtonect::openFrameFile(const std::string& path, ReplayMode mode, bool loop)
+{
+    ofProtonectFrameFileReader* reader = new ofProtonectFrameFileReader();
+
+    if (!reader->load(path))
+    {
+        delete reader;
+        return -1;
+    }
+
+    reader->setRealtime(mode == ReplayMode::REALTIME);
+    reader->setLoop(loop);
+
+    // Only wait for the streams that were recorded.
+    colorAvailable = reader->getStreams() & ofProtonectFrameFile::REGISTERED;
+    depthAvailable = reader->getStreams() & (ofProtonectFrameFile::DEPTH | ofProtonectFrameFile::IR);
+
+    // Set up front, the streams are started as lossless for frame files.
+    frameFile = reader;
+
+    // A failed open() deletes the reader and resets the frame file state.
+    if (open(reader) != 0)
+    {
+        return -1;
+    }
+
+    colorIsRegistered = true;
+
+    return 0;
+}
+
+ofProtonectFrameFileReader* ofProtonect::getFrameFile()
+{
+    return frameFile;
+}
+
+bool ofProtonect::startRecording(const std::string& path, bool recordPointCloud)
+{
+    if (!bOpened)
+    {
+        ofLogError("ofProtonect::startRecording") << "open a device first";
+        return false;
+    }
+
+    uint32_t streams = 0;
+
+    if (enableDepth)
+    {
+        streams |= ofProtonectFrameFile::DEPTH;
+    }
+    if (enableDepth && enableIr)
+    {
+        streams |= ofProtonectFrameFile::IR;
+    }
+    if (enableRGB && (registerImages || colorIsRegistered))
+    {
+        streams |= ofProtonectFrameFile::REGISTERED;
+    }
+    if (enableDepth && recordPointCloud)
+    {
+        streams |= ofProtonectFrameFile::POINT_CLOUD;
+    }
+
+    libfreenect2::Freenect2Device::IrCameraParams irParams;
+    libfreenect2::Freenect2Device::ColorCameraParams colorParams;
+
+    {
+        // The processing thread may be opening the device again.
+        std::unique_lock<std::mutex> lock(deviceMutex);
+
+        if (!dev)
+        {
+            ofLogError("ofProtonect::startRecording") << "the device failed";
+            return false;
+        }
+
+        irParams = dev->getIrCameraParams();
+        colorParams = dev->getColorCameraParams();
+    }
+
+    std::unique_lock<std::mutex> lock(recordingMutex);
+
+    if (!recording.open(path, streams, irParams, colorParams))
+    {
+        ofLogError("ofProtonect::startRecording") << "can't write " << path;
+        return false;
+    }
+
+    return true;
+}
+
+void ofProtonect::stopRecording()
+{
+    std::unique_lock<std::mutex> lock(recordingMutex);
+
+    if (recording.isOpen() && !recording.close())
+    {
+        ofLogError("ofProtonect::stopRecording") << "failure finishing the recording";
+    }
+}
+
+bool ofProtonect::isRecording() const
+{
+    std::unique_lock<std::mutex> lock(recordingMutex);
+    return recording.isOpen();
+}
+
+void ofProtonect::recordFrame(const libfreenect2::Frame* depth,
+                              const libfreenect2::Frame* ir,
+                              const libfreenect2::Frame* registered,
+                              const libfreenect2::Frame* undistorted)
+{
+    std::unique_lock<std::mutex> lock(recordingMutex);
+
+    const libfreenect2::Frame* reference = depth ? depth : ir;
+
+    if (!recording.isOpen() || !reference)
+    {
+        return;
+    }
+
+    const float* pointCloud = nullptr;
+
+    if ((recording.getStreams() & ofProtonectFrameFile::POINT_CLOUD) && undistorted)
+    {
+        const std::size_t height = pointCloudKernel.getHeight();
+        const float* undistortedData = reinterpret_cast<const float*>(undistorted->data);
+
+        recordingPointCloud.resize(pointCloudKernel.getWidth() * height * 3);
+        float* points = recordingPointCloud.data();
+
+        // The same points as Registration::getPointXYZ(), from the precomputed rays.
+        parallelFor((height + ROWS_PER_BAND - 1) / ROWS_PER_BAND, [&](std::size_t band) {
+            pointCloudKernel.computeCameraPoints(undistortedData, points, band * ROWS_PER_BAND, (band + 1) * ROWS_PER_BAND);
+        });
+
+        pointCloud = recordingPointCloud.data();
+    }
+
+    if (!recording.write(reference->timestamp,
+                         reference->sequence,
+                         depth ? reinterpret_cast<const float*>(depth->data) : nullptr,
+                         ir ? reinterpret_cast<const float*>(ir->data) : nullptr,
+                         registered ? registered->data : nullptr,
+                         pointCloud))
+    {
+        ofLogError("ofProtonect::recordFrame") << "failure writing, recording stopped";
+        recording.close();
+    }
+}
+
+int ofProtonect::open(libfreenect2::Freenect2Device* frameSource)
+{
+    {
+        std::unique_lock<std::mutex> lock(deviceMutex);
+        dev = frameSource;
+    }
+
+    if (!dev)
+    {
+        ofLogError("ofProtonect::openKinect")  << "no frame source";
+        closeDevice();
+        return -1;
+    }
+
+    streamsChanged = false;
+    waitCancelled = false;
+    deviceFailed = false;
+    irStarted = false;
+
+    if (!startStreams(enableRGB && colorAvailable, enableDepth && depthAvailable))
+    {
+        // We own the frame source from here on, also when it fails.
+        closeDevice();
+        return -1;
+    }
+
+    setColorCamSettings();
+
+    ofLogVerbose("ofProtonect::openKinect") << "device serial: " << dev->getSerialNumber();
+    ofLogVerbose("ofProtonect::openKinect") << "device firmware: " << dev->getFirmwareVersion();
+
+    registration = new libfreenect2::Registration(dev->getIrCameraParams(),
+                                                  dev->getColorCameraParams());
+    pointCloudKernel.setup(dev->getIrCameraParams());
+    decimatedKernel = ofProtonectPointCloudKernel();
+    bOpened = true;
+    
+    return 0;
+}
+
+bool ofProtonect::startStreams(bool rgb, bool depth)
+{
+    std::string serial = dev->getSerialNumber();
+
+    int types = 0;
+    
+    if (rgb)
+        types |= libfreenect2::Frame::Color;
+    if (depth)
+        types |= libfreenect2::Frame::Ir | libfreenect2::Frame::Depth;
+    
+    // Recordings must not drop frames, so their producer waits for us. With a
+    // single queue that could dead lock on replays where color and depth
+    // don't strictly alternate, hence color gets its own queue then. That
+    // queue doesn't block, it is only drained once per depth frame, so
+    // replayed color may be dropped. Frame files deliver both from one
+    // thread and keep them paired.
+    bool lossless = replay != nullptr || frameFile != nullptr;
+
+    // cancelWait() may look at the listeners from another thread.
+    std::unique_lock<std::mutex> lock(listenerMutex);
+
+    if ((streamMode == StreamMode::DEPTH_DRIVEN || replay) && rgb && depth)
+    {
+        // Separate queues, so a slow color camera never holds depth back.
+        listener = new ofProtonectFrameListener(libfreenect2::Frame::Ir | libfreenect2::Frame::Depth, framePoolSize);
+        colorListener = new ofProtonectFrameListener(libfreenect2::Frame::Color, framePoolSize);
+
+        dev->setColorFrameListener(colorListener);
+        dev->setIrAndDepthFrameListener(listener);
+    }
+    else
+    {
+        listener = new ofProtonectFrameListener(types, framePoolSize);
+
+        dev->setColorFrameListener(listener);
+        dev->setIrAndDepthFrameListener(listener);
+    }
+
+    listener->setBlocking(lossless);
+
+    // A close may have begun while the streams were restarted.
+    if (waitCancelled)
+    {
+        listener->cancel();
+
+        if (colorListener)
+        {
+            colorListener->cancel();
+        }
+    }
+
+    lock.unlock();
+    
+    /// [start]
+    if (rgb && depth)
+    {
+        if (!dev->start())
+        {
+            ofLogError("ofProtonect::openKinect")  << "Error starting default stream for: " << serial;
+            return false;
+        }
+    }
+    else
+    {
+        if (!dev->startStreams(rgb, depth))
+        {
+            ofLogError("ofProtonect::openKinect")  << "Error starting selected streams for: " << serial;
+            return false;
+        }
+    }
+
+    streamingRGB = rgb;
+    streamingDepth = depth;
+    colorIgnored = false;
+    irStarted = irStarted || depth;
+
+    return true;
+}
+
+void ofProtonect::stopStreams()
+{
+    // Let a producer that waits for us finish.
+    listener->setBlocking(false);
+
+    // libfreenect2 delivers frames until it is stopped, only then the
+    // listeners can be freed.
+    dev->stop();
+
+    {
+        // Frames still held by consumers keep the listener's pool state alive.
+        std::unique_lock<std::mutex> lock(listenerMutex);
+        delete listener;
+        listener = nullptr;
+        delete colorListener;
+        colorListener = nullptr;
+    }
+
+    latestColorFrames.clear();
+
+    streamingRGB = false;
+    streamingDepth = false;
+    colorIgnored = false;
+}
+
+bool ofProtonect::updateStreams()
+{
+    const bool rgb = enableRGB && colorAvailable;
+    const bool depth = enableDepth && depthAvailable;
+
+    if (rgb == (streamingRGB && !colorIgnored) && depth == streamingDepth)
+    {
+        return true;
+    }
+
+    // Stopping only the color stream stops the IR stream as well, so while
+    // depth keeps streaming color is ignored instead of restarting the device.
+    if (depth && streamingDepth && streamingRGB)
+    {
+        setColorIgnored(!rgb);
+        return true;
+    }
+
+    stopStreams();
+
+    // A sensor doesn't start its IR stream again once it was stopped, it
+    // has to be opened again for that. The pipeline belongs to the device.
+    if (!deviceSerial.empty() && depth && irStarted)
+    {
+        std::unique_lock<std::mutex> lock(deviceMutex);
+
+        dev->close();
+        delete dev;
+
+        pipeline = createPipeline(devicePipelineType, devicePipelineDevice);
+        dev = pipeline ? freenect2.openDevice(deviceSerial, pipeline) : freenect2.openDevice(deviceSerial);
+        irStarted = false;
+
+        if (!dev)
+        {
+            ofLogError("ofProtonect::updateStreams") << "failure opening device with serial " << deviceSerial << " again";
+            pipeline = nullptr;
+            deviceFailed = true;
+            return false;
+        }
+    }
+
+    if (!startStreams(rgb, depth))
+    {
+        deviceFailed = true;
+        return false;
+    }
+
+    setColorCamSettings();
+
+    return true;
+}
+
+void ofProtonect::setColorIgnored(bool ignored)
+{
+    // cancelWait() may look at the listeners from another thread.
+    std::unique_lock<std::mutex> lock(listenerMutex);
+
+    if (colorListener)
+    {
+        colorListener->setFrameTypes(ignored ? 0 : libfreenect2::Frame::Color);
+        latestColorFrames.clear();
+    }
+    else
+    {
+        listener->setFrameTypes(libfreenect2::Frame::Ir | libfreenect2::Frame::Depth | (ignored ? 0 : libfreenect2::Frame::Color));
+    }
+
+    colorIgnored = ignored;
+}
+
+bool ofProtonect::updateKinect(FrameSet& frameSet, int steps, float minDistance, float maxDistance, float facesMaxLength)
+{
+	if (bOpened)
+	{
+		if (waitCancelled || deviceFailed)
+		{
+			return false;
+		}
+
+		// Streams are only started and stopped on this thread.
+		if (streamsChanged.exchange(false) && !updateStreams())
+		{
+			return false;
+		}
+
+		// The decoded frames stay alive as long as frameSet, its pixels wrap them.
+		ofProtonectFrameListener::FrameMap& frames = frameSet.frames;
+
+		uint64_t startTime = ofProtonectTimings::now();
+
+		if (!listener->waitForNewFrame(frames, 10 * 1000))
+		{
+			if (waitCancelled)
+			{
+				return false;
+			}
+
+			ofLogError("ofProtonect::updateKinect") << "Timeout serial: " << dev->getSerialNumber();
+			return false;
+		}
+
+		if (colorListener)
+		{
+			attachLatestColorFrame(frames);
+		}
+
+		if (paceReplay)
+		{
+			paceReplayFrame(frames);
+		}
+
+		timings.record(ofProtonectTimings::Stage::WAIT_FOR_FRAME, startTime);
+
+		frameCount++;
+
+		libfreenect2::Frame* rgb = frames[libfreenect2::Frame::Color].get();
+		libfreenect2::Frame* ir = frames[libfreenect2::Frame::Ir].get();
+		libfreenect2::Frame* depth = frames[libfreenect2::Frame::Depth].get();
+
+		if (!frameSet.undistorted)
+		{
+			frameSet.undistorted.reset(new libfreenect2::Frame(512, 424, 4));
+			frameSet.registered.reset(new libfreenect2::Frame(512, 424, 4));
+		}
+
+		// Decide once which outputs are computed, the settings may change
+		// during the frame. Outputs that weren't asked for recently are
+		// skipped when demand driven.
+		FrameState& state = frameState;
+		state = FrameState();
+		state.frameSet = &frameSet;
+		state.rgb = rgb;
+		state.ir = ir;
+		state.depth = depth;
+		state.undistorted = frameSet.undistorted.get();
+		state.registered = frameSet.registered.get();
+		state.steps = steps;
+		state.minDistance = minDistance;
+		state.maxDistance = maxDistance;
+		state.facesMaxLength = facesMaxLength;
+		state.registerImages = registerImages;
+		state.useRegistered = (registerImages || colorIsRegistered) && isWanted(Output::REGISTERED);
+		state.organizedPointCloud = isWanted(Output::ORGANIZED_POINT_CLOUD) ? organizedPointCloud : OrganizedPointCloud::NONE;
+		state.compact = compactPointCloud;
+		state.geometryOnly = pointCloudGeometryOnly;
+
+		if (colorIsRegistered && rgb)
+		{
+			// The color of a frame file was registered when it was recorded.
+			// Resolved before the graph runs, nodes that don't depend on
+			// REGISTER read the pointer concurrently.
+			state.registered = rgb;
+			state.registeredValid = true;
+		}
+
+		// Every output is the node computing it, scheduling adds the nodes
+		// it depends on.
+		ofProtonectFrameGraph::NodeSet outputs = toSet(Node::PIXELS);
+
+		if (state.useRegistered)
+		{
+			outputs |= toSet(Node::REGISTER);
+		}
+
+		if (wasRequested(Output::UNDISTORTED) && isWanted(Output::UNDISTORTED))
+		{
+			outputs |= toSet(Node::UNDISTORT);
+		}
+
+		if (isRecording())
+		{
+			outputs |= toSet(Node::RECORD);
+		}
+
+		if ((useDistancePixels || wasRequested(Output::DISTANCE)) && isWanted(Output::DISTANCE))
+		{
+			outputs |= toSet(Node::DISTANCE);
+		}
+
+		if (state.organizedPointCloud != OrganizedPointCloud::NONE)
+		{
+			outputs |= toSet(Node::ORGANIZED_POINT_CLOUD);
+		}
+
+		if ((useDepthPixels || wasRequested(Output::DEPTH_PIXELS)) && isWanted(Output::DEPTH_PIXELS))
+		{
+			outputs |= toSet(Node::DEPTH_PIXELS);
+		}
+
+		if ((useIrPixels || wasRequested(Output::IR_PIXELS)) && isWanted(Output::IR_PIXELS))
+		{
+			outputs |= toSet(Node::IR_PIXELS);
+		}
+
+		if (usePointCloud && isWanted(Output::POINT_CLOUD))
+		{
+			outputs |= toSet(Node::POINT_CLOUD) | (pointCloudFilled ? toSet(Node::FACES) : 0);
+		}
+
+		// The inputs that depend on the settings. Registering needs the depth
+		// unless a frame file was registered when it was recorded.
+		const ofProtonectFrameGraph::NodeSet registeredColor = registerImages || colorIsRegistered ? toSet(Node::REGISTER) : 0;
+
+		frameGraph.setInputs(toId(Node::REGISTER), colorIsRegistered ? 0 : toSet(Node::UNDISTORT));
+		frameGraph.setInputs(toId(Node::RECORD), toSet(Node::UNDISTORT) | registeredColor);
+		frameGraph.setInputs(toId(Node::ORGANIZED_POINT_CLOUD), toSet(Node::UNDISTORT)
+			| (state.organizedPointCloud == OrganizedPointCloud::XYZRGB ? toSet(Node::REGISTER) : 0));
+		frameGraph.setInputs(toId(Node::POINT_CLOUD), toSet(Node::UNDISTORT)
+			| (pointCloudTexCoords || state.geometryOnly ? 0 : toSet(Node::REGISTER)));
+
+		if (rgb)
+		{
+			rgbFormat = rgb->format == libfreenect2::Frame::BGRX ? OF_PIXELS_BGRA : OF_PIXELS_RGBA;
+		}
+
+		// Shared by nodes that may run concurrently, so it is set up front.
+		pointCloudKernel.setDepthRange(minDistance, maxDistance);
+
+		frameGraph.schedule(outputs);
+		frameGraph.run(workerPool);
+
+		recordNodeTimings(ofProtonectTimings::Stage::REGISTRATION, toSet(Node::UNDISTORT) | toSet(Node::REGISTER));
+		recordNodeTimings(ofProtonectTimings::Stage::PIXELS, toSet(Node::PIXELS) | toSet(Node::DISTANCE) | toSet(Node::ORGANIZED_POINT_CLOUD));
+		recordNodeTimings(ofProtonectTimings::Stage::CONVERSION, toSet(Node::DEPTH_PIXELS) | toSet(Node::IR_PIXELS));
+		recordNodeTimings(ofProtonectTimings::Stage::POINT_CLOUD, toSet(Node::POINT_CLOUD));
+		recordNodeTimings(ofProtonectTimings::Stage::FACES, toSet(Node::FACES));
+
+		return true;
+	}
+
+	return false;
+}
+
+
+ofProtonectFrameGraph::NodeSet ofProtonect::toSet(Node node)
+{
+    return ofProtonectFrameGraph::toSet(toId(node));
+}
+
+
+std::size_t ofProtonect::toId(Node node)
+{
+    return static_cast<std::size_t>(node);
+}
+
+
+void ofProtonect::setupFrameGraph()
+{
+    // Added in the order of Node, so the ids are the same.
+    frameGraph.addNode("undistort", [this]() { processUndistort(); }, [this]() {
+        frameState.frameSet->undistortedValid = false;
+    });
+
+    frameGraph.addNode("register", [this]() { processRegister(); }, [this]() {
+        frameState.frameSet->registeredPixels.clear();
+    });
+
+    frameGraph.addNode("pixels", [this]() { processPixels(); });
+
+    frameGraph.addNode("record", [this]() { processRecord(); });
+
+    frameGraph.addNode("distance", [this]() { processDistance(); }, [this]() {
+        frameState.frameSet->distancePixels.clear();
+    });
+
+    frameGraph.addNode("organized point cloud", [this]() { processOrganizedPointCloud(); }, [this]() {
+        frameState.frameSet->organizedPointCloud.clear();
+    });
+
+    frameGraph.addNode("depth pixels", [this]() { processDepthPixels(); }, [this]() {
+        frameState.frameSet->depthPixels.clear();
+    });
+
+    frameGraph.addNode("ir pixels", [this]() { processIrPixels(); }, [this]() {
+        frameState.frameSet->irPixels.clear();
+    });
+
+    frameGraph.addNode("point cloud", [this]() { processPointCloud(); }, [this]() {
+        // Keeps the capacity, and the texture coordinates for later.
+        ofVboMesh& pointCloud = frameState.frameSet->pointCloud;
+        pointCloud.getVertices().clear();
+        pointCloud.getColors().clear();
+        pointCloud.getIndices().clear();
+    });
+
+    frameGraph.addNode("faces", [this]() { processFaces(); }, [this]() {
+        frameState.frameSet->pointCloud.getIndices().clear();
+    });
+
+    // The inputs that don't depend on the settings, updateKinect() sets the others.
+    frameGraph.setInputs(toId(Node::DISTANCE), toSet(Node::UNDISTORT));
+    frameGraph.setInputs(toId(Node::DEPTH_PIXELS), toSet(Node::PIXELS));
+    frameGraph.setInputs(toId(Node::IR_PIXELS), toSet(Node::PIXELS));
+    frameGraph.setInputs(toId(Node::FACES), toSet(Node::POINT_CLOUD));
+}
+
+
+void ofProtonect::recordNodeTimings(ofProtonectTimings::Stage stage, ofProtonectFrameGraph::NodeSet nodes)
+{
+    if ((frameGraph.getScheduled() & nodes) == 0)
+    {
+        return;
+    }
+
+    // Nodes of a stage that ran concurrently add up.
+    uint64_t duration = 0;
+
+    for (std::size_t i = 0; i < frameGraph.getNumNodes(); i++)
+    {
+        if (nodes & ofProtonectFrameGraph::toSet(i))
+        {
+            duration += frameGraph.getDuration(i);
+        }
+    }
+
+    timings.recordDuration(stage, duration);
+}
+
+
+void ofProtonect::processUndistort()
+{
+    FrameState& state = frameState;
+
+    // libfreenect2 undistorts the depth while registering the color, so the
+    // color is registered right away if it is needed.
+    if (!colorIsRegistered && state.registerImages && state.rgb && frameGraph.isScheduled(toId(Node::REGISTER)))
+    {
+        registration->apply(state.rgb,
+            state.depth,
+            state.undistorted,
+            state.registered);
+        state.undistortedValid = true;
+        state.registeredValid = true;
+    }
+    else if (state.depth)
+    {
+        registration->undistortDepth(state.depth, state.undistorted);
+        state.undistortedValid = true;
+    }
+
+    state.frameSet->undistortedValid = state.undistortedValid;
+}
+
+
+void ofProtonect::processRegister()
+{
+    FrameState& state = frameState;
+
+    if (!state.registeredValid)
+    {
+        // Without a color frame (depth driven mode) the points have no color.
+        std::memset(state.registered->data, 0, state.registered->width * state.registered->height * state.registered->bytes_per_pixel);
+    }
+
+    ofPixels& rgbRegisteredPixels = state.frameSet->registeredPixels;
+
+    if (state.useRegistered && state.registeredValid)
+    {
+        rgbRegisteredPixels.setFromExternalPixels(state.registered->data, state.registered->width, state.registered->height, rgbFormat);
+    }
+    else
+    {
+        rgbRegisteredPixels.clear();
+    }
+}
+
+
+void ofProtonect::processPixels()
+{
+    const FrameState& state = frameState;
+    libfreenect2::Frame* rgb = state.rgb;
+    libfreenect2::Frame* ir = state.ir;
+    libfreenect2::Frame* depth = state.depth;
+
+    ofPixels& rgbPixels = state.frameSet->pixels;
+    ofFloatPixels& depthPixels = state.frameSet->rawDepthPixels;
+    ofFloatPixels& irPixels = state.frameSet->rawIRPixels;
+
+    if (enableRGB && rgb)
+    {
+        rgbPixels.setFromExternalPixels(rgb->data, rgb->width, rgb->height, rgbFormat);
+    }
+    else
+    {
+        rgbPixels.clear();
+    }
+
+    if (enableDepth && depth)
+    {
+        depthPixels.setFromExternalPixels(reinterpret_cast<float*>(depth->data), depth->width, depth->height, 1);
+    }
+    else
+    {
+        depthPixels.clear();
+    }
+
+    if (enableIr && ir)
+    {
+        irPixels.setFromExternalPixels(reinterpret_cast<float*>(ir->data), ir->width, ir->height, 1);
+    }
+    else
+    {
+        irPixels.clear();
+    }
+}
+
+
+void ofProtonect::processRecord()
+{
+    const FrameState& state = frameState;
+
+    recordFrame(state.depth,
+                state.ir,
+                state.registeredValid ? state.registered : nullptr,
+                state.undistortedValid ? state.undistorted : nullptr);
+}
+
+
+void ofProtonect::processDistance()
+{
+    const FrameState& state = frameState;
+    ofFloatPixels& distancePixels = state.frameSet->distancePixels;
+
+    if (!state.undistortedValid)
+    {
+        distancePixels.clear();
+        return;
+    }
+
+    const float* undistortedData = reinterpret_cast<const float*>(state.undistorted->data);
+    const std::size_t height = pointCloudKernel.getHeight();
+
+    distancePixels.allocate(pointCloudKernel.getWidth(), height, 1);
+    float* distances = distancePixels.getData();
+
+    parallelFor((height + ROWS_PER_BAND - 1) / ROWS_PER_BAND, [&](std::size_t band) {
+        pointCloudKernel.computeDistances(undistortedData, distances, band * ROWS_PER_BAND, (band + 1) * ROWS_PER_BAND);
+    });
+}
+
+
+void ofProtonect::processOrganizedPointCloud()
+{
+    const FrameState& state = frameState;
+    ofFloatPixels& organizedPixels = state.frameSet->organizedPointCloud;
+
+    if (!state.undistortedValid)
+    {
+        organizedPixels.clear();
+        return;
+    }
+
+    const std::size_t channels = state.organizedPointCloud == OrganizedPointCloud::XYZRGB ? 4 : 3;
+    const float* undistortedData = reinterpret_cast<const float*>(state.undistorted->data);
+    const unsigned char* registeredData = state.registered->data;
+    const std::size_t height = pointCloudKernel.getHeight();
+
+    organizedPixels.allocate(pointCloudKernel.getWidth(), height, channels);
+    float* points = organizedPixels.getData();
+
+    parallelFor((height + ROWS_PER_BAND - 1) / ROWS_PER_BAND, [&](std::size_t band) {
+        const std::size_t rowBegin = band * ROWS_PER_BAND;
+        const std::size_t rowEnd = rowBegin + ROWS_PER_BAND;
+
+        if (transformPointCloud)
+        {
+            pointCloudKernel.computePoints(undistortedData, pointCloudTransformationMat, points, channels, rowBegin, rowEnd);
+        }
+        else
+        {
+            pointCloudKernel.computePoints(undistortedData, points, channels, rowBegin, rowEnd);
+        }
+
+        if (channels == 4)
+        {
+            pointCloudKernel.computePackedColors(registeredData, points, rowBegin, rowEnd);
+        }
+    });
+}
+
+
+void ofProtonect::processDepthPixels()
+{
+    const FrameState& state = frameState;
+    const ofFloatPixels& depthPixels = state.frameSet->rawDepthPixels;
+    ofPixels& grayPixels = state.frameSet->depthPixels;
+
+    if (depthPixels.size() == 0)
+    {
+        grayPixels.clear();
+        return;
+    }
+
+    const std::size_t width = depthPixels.getWidth();
+    const std::size_t height = depthPixels.getHeight();
+    const float* values = depthPixels.getData();
+    const float minDistance = state.minDistance;
+    const float maxDistance = state.maxDistance;
+
+    grayPixels.allocate(width, height, 1);
+    unsigned char* gray = grayPixels.getData();
+
+    // Bands of rows of the 8 bit image, converted on the worker pool.
+    parallelFor((height + ROWS_PER_BAND - 1) / ROWS_PER_BAND, [&](std::size_t band) {
+        const std::size_t begin = band * ROWS_PER_BAND * width;
+        const std::size_t end = std::min((band + 1) * ROWS_PER_BAND, height) * width;
+
+        ofProtonectImageConversion::convertDepth(values + begin, end - begin, minDistance, maxDistance, gray + begin);
+    });
+
+    state.frameSet->depthPixelsMinDistance = minDistance;
+    state.frameSet->depthPixelsMaxDistance = maxDistance;
+}
+
+
+void ofProtonect::processIrPixels()
+{
+    const FrameState& state = frameState;
+    const ofFloatPixels& irPixels = state.frameSet->rawIRPixels;
+    ofPixels& grayPixels = state.frameSet->irPixels;
+
+    if (irPixels.size() == 0)
+    {
+        grayPixels.clear();
+        return;
+    }
+
+    const std::size_t width = irPixels.getWidth();
+    const std::size_t height = irPixels.getHeight();
+    const float* values = irPixels.getData();
+
+    grayPixels.allocate(width, height, 1);
+    unsigned char* gray = grayPixels.getData();
+
+    parallelFor((height + ROWS_PER_BAND - 1) / ROWS_PER_BAND, [&](std::size_t band) {
+        const std::size_t begin = band * ROWS_PER_BAND * width;
+        const std::size_t end = std::min((band + 1) * ROWS_PER_BAND, height) * width;
+
+        ofProtonectImageConversion::convertIr(values + begin, end - begin, IR_PIXELS_MAX_VALUE, gray + begin);
+    });
+}
+
+
+void ofProtonect::processPointCloud()
+{
+    FrameState& state = frameState;
+    ofVboMesh& pointCloud = state.frameSet->pointCloud;
+
+    std::vector<glm::vec3>& pcVerts = pointCloud.getVertices();
+    std::vector<ofDefaultColorType>& pcColors = pointCloud.getColors();
+    std::vector<glm::vec2>& pcTexCoords = pointCloud.getTexCoords();
+
+    if (!state.undistortedValid) {
+        // Keeps the capacity, and the texture coordinates for later.
+        pcVerts.clear();
+        pcColors.clear();
+        return;
+    }
+
+    pointCloud.setMode(pointCloudFilled ? OF_PRIMITIVE_TRIANGLES : OF_PRIMITIVE_POINTS);
+
+    const float* undistortedData = reinterpret_cast<const float*>(state.undistorted->data);
+    const unsigned char* registeredData = state.registered->data;
+    const int steps = state.steps;
+
+    // With decimation the grid only has every steps-th row and column.
+    const ofProtonectPointCloudKernel::Decimation decimation = steps > 1 ? pointCloudDecimation : ofProtonectPointCloudKernel::Decimation::NONE;
+    const bool decimate = decimation != ofProtonectPointCloudKernel::Decimation::NONE;
+
+    if (decimate && (!decimatedKernel.isSetup() || decimatedKernel.getSteps() != static_cast<std::size_t>(steps))) {
+        decimatedKernel.setup(pointCloudKernel.getIrCameraParams(), state.undistorted->width, state.undistorted->height, steps);
+    }
+
+    if (decimate) {
+        decimatedKernel.setDepthRange(state.minDistance, state.maxDistance);
+    }
+
+    ofProtonectPointCloudKernel& kernel = decimate ? decimatedKernel : pointCloudKernel;
+
+    const int width = kernel.getWidth();
+    const int height = kernel.getHeight();
+    const int gridSteps = kernel.getSteps();
+    const auto frameSize = width * height;
+
+    if (decimate) {
+        decimatedDepth.resize(frameSize);
+        decimatedRegistered.resize(frameSize * 4);
+    }
+
+    const bool compact = state.compact;
+
+    // The whole grid is computed first, straight into the mesh unless
+    // the invalid points are dropped afterwards.
+    std::vector<glm::vec3>& gridVerts = compact ? compactionVertices : pcVerts;
+    std::vector<ofFloatColor>& gridColors = compact ? compactionColors : pcColors;
+
+    gridVerts.resize(frameSize);
+
+    // Bands of rows are independent, run them on the worker pool.
+    const std::size_t numRowBands = (height + ROWS_PER_BAND - 1) / ROWS_PER_BAND;
+    const bool withColors = !pointCloudTexCoords && !state.geometryOnly;
+    const bool withTexCoords = pointCloudTexCoords && !state.geometryOnly;
+
+    if (withColors) {
+        gridColors.resize(frameSize);
+    }
+
+    if (state.geometryOnly) {
+        pcColors.clear();
+        pcTexCoords.clear();
+    }
+
+    parallelFor(numRowBands, [&](std::size_t band) {
+        const std::size_t rowBegin = band * ROWS_PER_BAND;
+        const std::size_t rowEnd = rowBegin + ROWS_PER_BAND;
+
+        const float* depth = undistortedData;
+
+        if (decimate) {
+            kernel.decimateDepth(undistortedData, decimation, decimatedDepth.data(), rowBegin, rowEnd);
+            depth = decimatedDepth.data();
+        }
+
+        if (transformPointCloud)
+        {
+            kernel.computeVertices(depth, pointCloudTransformationMat, gridVerts.data(), rowBegin, rowEnd);
+        }
+        else
+        {
+            kernel.computeVertices(depth, gridVerts.data(), rowBegin, rowEnd);
+        }
+
+        if (withColors) {
+            const unsigned char* colors = registeredData;
+
+            if (decimate) {
+                kernel.decimateColors(registeredData, decimatedRegistered.data(), rowBegin, rowEnd);
+                colors = decimatedRegistered.data();
+            }
+
+            kernel.computeColors(depth, colors, pointCloudAlpha, gridColors.data(), rowBegin, rowEnd);
+        }
+    });
+
+    if (compact) {
+        // Count the valid points of every band, then each band moves
+        // its points to the offset of its first one and remembers
+        // where every pixel went for the faces.
+        compactionOffsets.resize(numRowBands + 1);
+        compactionRemap.resize(frameSize);
+
+        parallelFor(numRowBands, [&](std::size_t band) {
+            const std::size_t pixelBegin = band * ROWS_PER_BAND * width;
+            const std::size_t pixelEnd = std::min<std::size_t>(pixelBegin + ROWS_PER_BAND * width, frameSize);
+            std::size_t numValid = 0;
+
+            for (std::size_t i = pixelBegin; i < pixelEnd; i++) {
+                numValid += std::isnan(gridVerts[i].z) ? 0 : 1;
+            }
+
+            compactionOffsets[band + 1] = numValid;
+        });
+
+        compactionOffsets[0] = 0;
+
+        for (std::size_t band = 0; band < numRowBands; band++) {
+            compactionOffsets[band + 1] += compactionOffsets[band];
+        }
+
+        const std::size_t numValid = compactionOffsets[numRowBands];
+
+        pcVerts.resize(numValid);
+
+        if (withColors) {
+            pcColors.resize(numValid);
+        }
+        else if (withTexCoords) {
+            pcTexCoords.resize(numValid);
+        }
+
+        parallelFor(numRowBands, [&](std::size_t band) {
+            const std::size_t pixelBegin = band * ROWS_PER_BAND * width;
+            const std::size_t pixelEnd = std::min<std::size_t>(pixelBegin + ROWS_PER_BAND * width, frameSize);
+            std::size_t index = compactionOffsets[band];
+
+            for (std::size_t i = pixelBegin; i < pixelEnd; i++) {
+                if (std::isnan(gridVerts[i].z)) {
+                    compactionRemap[i] = INVALID_INDEX;
+                    continue;
+                }
+
+                compactionRemap[i] = static_cast<ofIndexType>(index);
+                pcVerts[index] = gridVerts[i];
+
+                if (withColors) {
+                    pcColors[index] = gridColors[i];
+                }
+                else if (withTexCoords) {
+                    pcTexCoords[index] = glm::vec2(i % width * gridSteps, i / width * gridSteps);
+                }
+
+                index++;
+            }
+        });
+    }
+    else if (withTexCoords) {
+        // Texture coordinates only depend on the grid size. Compacted
+        // ones only have that size if no point was dropped, then they
+        // are the same.
+        if (pcTexCoords.size() != static_cast<std::size_t>(frameSize)) {
+            pcTexCoords.resize(frameSize);
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    pcTexCoords[y * width + x] = glm::vec2(x * gridSteps, y * gridSteps);
+                }
+            }
+        }
+    }
+
+    state.gridVertices = &gridVerts;
+    state.gridWidth = width;
+    state.gridHeight = height;
+    state.decimated = decimate;
+}
+
+
+void ofProtonect::processFaces()
 {
-    switch (packetPipelineType)
-    {
-        case PacketPipelineType::CPU:
-            pipeline = new libfreenect2::CpuPacketPipeline();
-            break;
-        case PacketPipelineType::OPENGL:
-            pipeline = new libfreenect2::OpenGLPacketPipeline();
-            break;
-		case PacketPipelineType::OPENCL:
-			pipeline = new libfreenect2::OpenCLPacketPipeline(device);
-			break;
-		case PacketPipelineType::OPENCLKDE:
-			pipeline = new libfreenect2::OpenCLKdePacketPipeline(device);
-			break;
-#if defined(LIBFREENECT2_WITH_CUDA_SUPPORT)
-		
-        case PacketPipelineType::CUDA:
-			pipeline = new libfreenect2::CudaPacketPipeline(device);
-            break;
-        case PacketPipelineType::CUDAKDE:
-            pipeline = new libfreenect2::CudaKdePacketPipeline(device);
-            break;
-#endif
-        case PacketPipelineType::DEFAULT:
-            break;
-    }
+    const FrameState& state = frameState;
+    std::vector<ofIndexType>& pcIndicies = state.frameSet->pointCloud.getIndices();
 
-    if (pipeline)
-    {
-        dev = freenect2.openDevice(serial, pipeline);
+    if (!state.gridVertices) {
+        pcIndicies.clear();
+        return;
     }
-    else
-    {
-        dev = freenect2.openDevice(serial);
+
+    // A decimated grid already is spaced steps pixels apart.
+    faceTopology.setup(state.gridWidth, state.gridHeight, state.decimated ? 1 : state.steps);
+
+    // Every band triangulates a range of rows into its own part
+    // of the face buffer, which are then concatenated in band
+    // order, so the faces are the same for any number of threads.
+    // Triangles with invalid or out of range points are NaN and
+    // fail the facesMaxLength test.
+    const glm::vec3* gridVerts = state.gridVertices->data();
+    const bool compact = state.compact;
+    const std::size_t numRows = faceTopology.getNumRows();
+    const std::size_t maxIndicesPerRow = faceTopology.getMaxIndicesPerRow();
+    const std::size_t numFaceBands = std::min<std::size_t>(numRows, getConcurrency() * 4);
+
+    faceBuffer.resize(numRows * maxIndicesPerRow);
+    faceBandOffsets.resize(numFaceBands + 1);
+
+    parallelFor(numFaceBands, [&](std::size_t band) {
+        const std::size_t rowBegin = band * numRows / numFaceBands;
+        const std::size_t rowEnd = (band + 1) * numRows / numFaceBands;
+
+        faceBandOffsets[band + 1] = faceTopology.computeFaces(gridVerts, state.facesMaxLength, rowBegin, rowEnd, faceBuffer.data() + rowBegin * maxIndicesPerRow);
+    });
+
+    faceBandOffsets[0] = 0;
+
+    for (std::size_t band = 0; band < numFaceBands; band++) {
+        faceBandOffsets[band + 1] += faceBandOffsets[band];
     }
 
-    if (!dev)
+    pcIndicies.resize(faceBandOffsets[numFaceBands]);
+
+    // Each band copies to its own offset, no locking needed.
+    parallelFor(numFaceBands, [&](std::size_t band) {
+        const ofIndexType* bandIndices = faceBuffer.data() + band * numRows / numFaceBands * maxIndicesPerRow;
+        const std::size_t numIndices = faceBandOffsets[band + 1] - faceBandOffsets[band];
+        ofIndexType* indices = pcIndicies.data() + faceBandOffsets[band];
+
+        if (compact) {
+            // Faces only reference valid points, which all were kept.
+            for (std::size_t i = 0; i < numIndices; i++) {
+                indices[i] = compactionRemap[bandIndices[i]];
+            }
+        }
+        else {
+            std::copy(bandIndices, bandIndices + numIndices, indices);
+        }
+    });
+}
+
+void ofProtonect::attachLatestColorFrame(ofProtonectFrameListener::FrameMap& frames)
+{
+    // Never blocks, latestColorFrames keeps the previous frame if there's no new one.
+    colorListener->waitForNewFrame(latestColorFrames, 0);
+
+    const std::shared_ptr<libfreenect2::Frame>& color = latestColorFrames[libfreenect2::Frame::Color];
+    const std::shared_ptr<libfreenect2::Frame>& depth = frames[libfreenect2::Frame::Depth];
+
+    // Both cameras stamp their frames with the same device clock.
+    if (color && depth && int32_t(depth->timestamp - color->timestamp) > int32_t(maxColorLag))
     {
-        ofLogError("ofProtonect::openKinect")  << "failure opening device with serial " << serial;
-        return -1;
+        return;
     }
 
-    int types = 0;
-    
-    if (enableRGB)
-        types |= libfreenect2::Frame::Color;
-    if (enableDepth)
-        types |= libfreenect2::Frame::Ir | libfreenect2::Frame::Depth;
-    
-    listener = new libfreenect2::SyncMultiFrameListener(types);
-    
-    dev->setColorFrameListener(listener);
-    dev->setIrAndDepthFrameListener(listener);
-    
-    /// [start]
-    if (enableRGB && enableDepth)
+    frames[libfreenect2::Frame::Color] = color;
+}
+
+ofProtonectTimings& ofProtonect::getTimings()
+{
+    return timings;
+}
+
+const ofProtonectTimings& ofProtonect::getTimings() const
+{
+    return timings;
+}
+
+uint64_t ofProtonect::getNumDroppedFrames() const
+{
+    uint64_t numDropped = listener ? listener->getNumDroppedFrames() : 0;
+
+    if (colorListener)
     {
-        if (!dev->start())
-        {
-            ofLogError("ofProtonect::openKinect")  << "Error starting default stream for: " << serial;
-            return -1;
-        }
+        numDropped += colorListener->getNumDroppedFrames();
     }
-    else
+
+    return numDropped;
+}
+
+void ofProtonect::setFramePoolSize(std::size_t size)
+{
+    framePoolSize = size;
+}
+
+std::size_t ofProtonect::getFramePoolSize() const
+{
+    return framePoolSize;
+}
+
+void ofProtonect::requestOutput(Output output)
+{
+    lastRequests[static_cast<std::size_t>(output)] = frameCount.load();
+}
+
+void ofProtonect::setDemandDriven(bool _demandDriven, uint64_t numFrames)
+{
+    demandFrames = numFrames;
+    demandDriven = _demandDriven;
+}
+
+bool ofProtonect::isDemandDriven() const
+{
+    return demandDriven;
+}
+
+bool ofProtonect::wasRequested(Output output) const
+{
+    return lastRequests[static_cast<std::size_t>(output)].load() != NEVER_REQUESTED;
+}
+
+bool ofProtonect::isWanted(Output output) const
+{
+    if (!demandDriven)
     {
-        if (!dev->startStreams(enableRGB, enableDepth))
-        {
-            ofLogError("ofProtonect::openKinect")  << "Error starting selected streams for: " << serial;
-            return -1;
-        }
+        return true;
     }
 
-    ofLogVerbose("ofProtonect::openKinect") << "device serial: " << dev->getSerialNumber();
-    ofLogVerbose("ofProtonect::openKinect") << "device firmware: " << dev->getFirmwareVersion();
+    const uint64_t lastRequest = lastRequests[static_cast<std::size_t>(output)].load();
+    return lastRequest != NEVER_REQUESTED && frameCount.load() - lastRequest <= demandFrames.load();
+}
 
-    registration = new libfreenect2::Registration(dev->getIrCameraParams(),
-                                                  dev->getColorCameraParams());
-    undistorted = new libfreenect2::Frame(512, 424, 4);
-    registered = new libfreenect2::Frame(512, 424, 4);
-	//bigFrame = new libfreenect2::Frame(1920, 1082, 4);
-    bOpened = true;
-    
-    return 0;
+void ofProtonect::setUseDepthPixels(bool useDepth)
+{
+    useDepthPixels = useDepth;
 }
 
-void ofProtonect::updateKinect(ofPixels& rgbPixels,
-                               ofPixels& rgbRegisteredPixels,
-                               ofFloatPixels& depthPixels,
-                               ofFloatPixels& irPixels,
-                               ofFloatPixels& distancePixels)
+bool ofProtonect::getUseDepthPixels() const
 {
-    if (bOpened)
-    {
-        if (!listener->waitForNewFrame(frames, 10 * 1000))
-        {
-            ofLogError("ofProtonect::updateKinect") << "Timeout serial: " << dev->getSerialNumber();
-            return;
-        }
+    return useDepthPixels;
+}
 
-        libfreenect2::Frame* rgb = frames[libfreenect2::Frame::Color];
-        libfreenect2::Frame* ir = frames[libfreenect2::Frame::Ir];
-        libfreenect2::Frame* depth = frames[libfreenect2::Frame::Depth];
+void ofProtonect::setUseIrPixels(bool useIr)
+{
+    useIrPixels = useIr;
+}
 
-        if (enableRGB && enableDepth)
-        {
-            registration->apply(rgb,
-                                depth,
-                                undistorted,
-                                registered,false);
-        }
+bool ofProtonect::getUseIrPixels() const
+{
+    return useIrPixels;
+}
 
-        ofPixelFormat rgbFormat;
-        if (rgb->format == libfreenect2::Frame::BGRX)
-        {
-            rgbFormat = OF_PIXELS_BGRA;
-        }
-        else
-        {
-            rgbFormat = OF_PIXELS_RGBA;
-        }
-        
-		rgbPixels.setFromPixels(rgb->data, rgb->width, rgb->height, rgbFormat);
-		rgbRegisteredPixels.setFromPixels(registered->data, registered->width, registered->height, rgbFormat);
+void ofProtonect::setUseDistancePixels(bool useDistance)
+{
+    useDistancePixels = useDistance;
+}
+
+bool ofProtonect::getUseDistancePixels() const
+{
+    return useDistancePixels;
+}
 
-		depthPixels.setFromPixels(reinterpret_cast<float*>(depth->data), ir->width, ir->height, 1);
-		irPixels.setFromPixels(reinterpret_cast<float*>(ir->data), ir->width, ir->height, 1);;
+void ofProtonect::setOrganizedPointCloud(OrganizedPointCloud mode)
+{
+    organizedPointCloud = mode;
+}
 
+ofProtonect::OrganizedPointCloud ofProtonect::getOrganizedPointCloud() const
+{
+    return organizedPointCloud;
+}
 
+void ofProtonect::setPointCloudDecimation(ofProtonectPointCloudKernel::Decimation decimation)
+{
+    pointCloudDecimation = decimation;
+}
 
+ofProtonectPointCloudKernel::Decimation ofProtonect::getPointCloudDecimation() const
+{
+    return pointCloudDecimation;
+}
 
-        listener->release(frames);
-    }
+void ofProtonect::setCompactPointCloud(bool compact)
+{
+    compactPointCloud = compact;
 }
-void ofProtonect::updateKinect(ofPixels& rgbPixels,
-	ofPixels& rgbRegisteredPixels,
-	ofFloatPixels& depthPixels,
-	ofFloatPixels& irPixels,
-	ofFloatPixels& distancePixels, std::vector<glm::vec3>& pcVerts, std::vector<ofDefaultColorType>& pcColors, std::vector<ofIndexType>& pcIndicies, std::vector<glm::vec2>& pcTexCoords, int steps, float minDistance, float maxDistance, float facesMaxLength)
+
+bool ofProtonect::getCompactPointCloud() const
 {
-	if (bOpened)
-	{
-		if (!listener->waitForNewFrame(frames, 10 * 1000))
-		{
-			ofLogError("ofProtonect::updateKinect") << "Timeout serial: " << dev->getSerialNumber();
-			return;
-		}
+    return compactPointCloud;
+}
 
-		libfreenect2::Frame* rgb = frames[libfreenect2::Frame::Color];
-		libfreenect2::Frame* ir = frames[libfreenect2::Frame::Ir];
-		libfreenect2::Frame* depth = frames[libfreenect2::Frame::Depth];
+void ofProtonect::setPointCloudGeometryOnly(bool geometryOnly)
+{
+    pointCloudGeometryOnly = geometryOnly;
+}
 
-		if (registerImages)
-		{
-			registration->apply(rgb,
-				depth,
-				undistorted,
-				registered);
-		}
-        if (enableRGB) {
-            
-            if (rgb->format == libfreenect2::Frame::BGRX)
-            {
-                rgbFormat = OF_PIXELS_BGRA;
-            }
-            else
-            {
-                rgbFormat = OF_PIXELS_RGBA;
-            }
-            
-            rgbPixels.setFromPixels(rgb->data, rgb->width, rgb->height, rgbFormat);
-        }
-        if (registerImages)
-        {
-            rgbRegisteredPixels.setFromPixels(registered->data, registered->width, registered->height, rgbFormat);
-        }
-        if (enableDepth) {
-            depthPixels.setFromPixels(reinterpret_cast<float*>(depth->data), ir->width, ir->height, 1);
+bool ofProtonect::getPointCloudGeometryOnly() const
+{
+    return pointCloudGeometryOnly;
+}
 
+void ofProtonect::setWorkerPool(ofProtonectWorkerPool* pool)
+{
+    workerPool = pool;
+}
+
+ofProtonectWorkerPool* ofProtonect::getWorkerPool() const
+{
+    return workerPool;
+}
+
+std::size_t ofProtonect::getConcurrency() const
+{
+    return workerPool ? workerPool->getConcurrency() : 1;
+}
+
+void ofProtonect::parallelFor(std::size_t numTasks, const std::function<void(std::size_t)>& task)
+{
+    if (workerPool)
+    {
+        workerPool->parallelFor(numTasks, task);
+    }
+    else
+    {
+        for (std::size_t i = 0; i < numTasks; i++)
+        {
+            task(i);
         }
-        
-        if (enableIr) {
-            irPixels.setFromPixels(reinterpret_cast<float*>(ir->data), ir->width, ir->height, 1);
-        }
+    }
+}
 
-		if (usePointCloud)
-		{
-			const int width = rgbRegisteredPixels.getWidth();
-			const int height = rgbRegisteredPixels.getHeight();
-			const auto frameSize = width * height;
+void ofProtonect::setStreamMode(StreamMode mode)
+{
+    streamMode = mode;
+}
 
-			pcVerts.clear();
-            if (pointCloudTexCoords) {
-                pcTexCoords.clear();
-            }
-            else{
-                pcColors.clear();
-            }
-			
-			pcIndicies.clear();
-			
-		
+ofProtonect::StreamMode ofProtonect::getStreamMode() const
+{
+    return streamMode;
+}
 
-            
-			for (std::size_t y = 0; y < rgbRegisteredPixels.getHeight(); y++){
-				for (std::size_t x = 0; x < rgbRegisteredPixels.getWidth(); x++)
-				{
-					glm::vec3 position;
-					float rgb;
-					registration->getPointXYZRGB(undistorted, registered, y, x, position.x, position.y, position.z,  rgb);
-					const uint8_t *p = reinterpret_cast<uint8_t*>(&rgb);
-					uint8_t b = p[0];
-					uint8_t g = p[1];
-					uint8_t r = p[2];
-					if (transformPointCloud) {
-						pcVerts.push_back(ofVec3f(position.x * 1000, position.y * -1000, position.z * -1000) * pointCloudTransformationMat);
-					}
-					else{
-						pcVerts.push_back(glm::vec3(position.x * 1000, position.y * -1000, position.z * -1000));
-
-					}
-                    if (pointCloudTexCoords) {
-                        pcTexCoords.push_back(ofVec2f(x, y));
-                    }
-                    else{
-                        pcColors.push_back(ofColor(r, g, b, pointCloudAlpha));
-
-                    }
-					
-				}
-			}
-            if (pointCloudFilled) {
-                for (int i = 0; i < width - steps; i += steps) {
-                    for (int j = 0; j < height - steps; j += steps) {
-                        int topLeft = width * j + i;
-                        int topRight = topLeft + steps;
-                        int bottomLeft = topLeft + width * steps;
-                        int bottomRight = bottomLeft + steps;
-                        const ofVec3f vTL = pcVerts[topLeft];
-                        const ofVec3f  vTR = pcVerts[topRight];
-                        const ofVec3f  vBL = pcVerts[bottomLeft];
-                        const ofVec3f  vBR = pcVerts[bottomRight];
-                        //cout << ofToString(vTL) << endl;
-                        //upper left triangle
-
-						/*if (-vTL.z > minDistance  && -vTL.z < maxDistance  && -vTR.z > minDistance  && -vTR.z < maxDistance  && -vBL.z > minDistance  && -vBL.z < maxDistance
-							&& abs(vTL.z - vTR.z) < facesMaxLength
-							&& abs(vTL.z - vBL.z) < facesMaxLength) {*/
-                        if (abs(vTL.z - vTR.z) < facesMaxLength
-                            && abs(vTL.z - vBL.z) < facesMaxLength) {
-                            const ofIndexType indices[3] = { static_cast<ofIndexType>(topLeft), static_cast<ofIndexType>(bottomLeft), static_cast<ofIndexType>(topRight) };
-                            pcIndicies.push_back(indices[0]);
-                            pcIndicies.push_back(indices[1]);
-                            pcIndicies.push_back(indices[2]);
-                        }
-                        
-                        //bottom right triangle
-						/*if (-vBR.z > minDistance && -vBR.z < maxDistance && -vTR.z > minDistance  && -vTR.z < maxDistance  && -vBL.z > minDistance  && -vBL.z < maxDistance
-							&& abs(vBR.z - vTR.z) < facesMaxLength
-							&& abs(vBR.z - vBL.z) < facesMaxLength) {*/
-                        if (abs(vBR.z - vTR.z) < facesMaxLength
-                            && abs(vBR.z - vBL.z) < facesMaxLength) {
-                            const ofIndexType indices[3] = { static_cast<ofIndexType>(topRight), static_cast<ofIndexType>(bottomRight), static_cast<ofIndexType>(bottomLeft) };
-                            pcIndicies.push_back(indices[0]);
-                            pcIndicies.push_back(indices[1]);
-                            pcIndicies.push_back(indices[2]);
-                            
-                        }
-                    }
-                }
-            }
-				
-		}
-		listener->release(frames);
-	}
+void ofProtonect::setMaxColorLag(uint32_t lag)
+{
+    maxColorLag = lag;
 }
 
 void ofProtonect::setUsePointCloud(bool _usePointCloud){
@@ -340,11 +1597,20 @@ void ofProtonect::setRegisterImages(bool _registerImages){
 void ofProtonect::setIsPointCloudFilled(bool _pointCloudFilled){
     pointCloudFilled = _pointCloudFilled;
 }
+void ofProtonect::setStreams(bool rgb, bool depth)
+{
+    enableRGB = rgb;
+    enableDepth = depth;
+    streamsChanged = true;
+}
+
 void ofProtonect::setUseRgb(bool _enableRGB){
     enableRGB = _enableRGB;
+    streamsChanged = true;
 }
 void ofProtonect::setUseDepth(bool _enableDepth){
     enableDepth = _enableDepth;
+    streamsChanged = true;
 }
 
 void ofProtonect::setUseIr(bool _enableIr)
@@ -433,8 +1699,77 @@ bool ofProtonect::getTransformPointCloud()
 {
 	return transformPointCloud;
 }
-void ofProtonect::setColorCamSettings(){
-    
+void ofProtonect::setColorAutoExposure(float exposureCompensation)
+{
+    // Auto and manual exposure replace each other.
+    applyColorSetting(-1, [exposureCompensation](libfreenect2::Freenect2Device* device)
+    {
+        device->setColorAutoExposure(exposureCompensation);
+    });
+}
+
+void ofProtonect::setColorManualExposure(float integrationTimeMs, float analogGain)
+{
+    applyColorSetting(-1, [integrationTimeMs, analogGain](libfreenect2::Freenect2Device* device)
+    {
+        device->setColorManualExposure(integrationTimeMs, analogGain);
+    });
+}
+
+void ofProtonect::setColorSetting(libfreenect2::ColorSettingCommandType cmd, uint32_t value)
+{
+    applyColorSetting(cmd, [cmd, value](libfreenect2::Freenect2Device* device)
+    {
+        device->setColorSetting(cmd, value);
+    });
+}
+
+void ofProtonect::setColorSetting(libfreenect2::ColorSettingCommandType cmd, float value)
+{
+    applyColorSetting(cmd, [cmd, value](libfreenect2::Freenect2Device* device)
+    {
+        device->setColorSetting(cmd, value);
+    });
+}
+
+void ofProtonect::applyColorSetting(int key, std::function<void(libfreenect2::Freenect2Device*)> apply)
+{
+    std::unique_lock<std::mutex> lock(deviceMutex);
+
+    // Keep the order the settings were made in, e.g. a gain after its mode.
+    for (auto iter = colorSettings.begin(); iter != colorSettings.end(); ++iter)
+    {
+        if (iter->first == key)
+        {
+            colorSettings.erase(iter);
+            break;
+        }
+    }
+
+    colorSettings.emplace_back(key, apply);
+
+    if (dev)
+    {
+        apply(dev);
+    }
+}
+
+void ofProtonect::setColorCamSettings()
+{
+    std::unique_lock<std::mutex> lock(deviceMutex);
+
+    if (dev)
+    {
+        for (const auto& setting: colorSettings)
+        {
+            setting.second(dev);
+        }
+    }
+}
+
+bool ofProtonect::hasFailed() const
+{
+    return deviceFailed;
 }
 
 void ofProtonect::setTransformationMatrix(ofMatrix4x4 _mat)
@@ -442,25 +1777,62 @@ void ofProtonect::setTransformationMatrix(ofMatrix4x4 _mat)
 	pointCloudTransformationMat = _mat;
 }
 
+void ofProtonect::cancelWait()
+{
+    std::unique_lock<std::mutex> lock(listenerMutex);
+
+    waitCancelled = true;
+
+    if (listener)
+    {
+        listener->cancel();
+    }
+
+    if (colorListener)
+    {
+        colorListener->cancel();
+    }
+}
+
+void ofProtonect::closeDevice()
+{
+    // Nothing is left to stop if opening the device again failed.
+    if (listener)
+    {
+        stopStreams();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(deviceMutex);
+
+        if (dev)
+        {
+            dev->close();
+            delete dev;
+            dev = nullptr;
+        }
+    }
+
+    // The device deleted its pipeline.
+    pipeline = nullptr;
+    deviceSerial.clear();
+    colorAvailable = true;
+    depthAvailable = true;
+    replay.reset();
+    paceReplay = false;
+    frameFile = nullptr;
+    colorIsRegistered = false;
+}
+
 int ofProtonect::closeKinect()
 {
   if (bOpened)
   {
-      listener->release(frames);
-      
-
-      // TODO: restarting ir stream doesn't work!
-      // TODO: bad things will happen, if frame listeners are freed before dev->stop() :(
-      dev->stop();
-      dev->close();
-
-      delete dev;
-      //delete pipeline;
-      //delete listener;
-      delete undistorted;
-      delete registered;
+      stopRecording();
+      closeDevice();
+
       delete registration;
-      delete bigFrame;
+      registration = nullptr;
       bOpened = false;
   }
 
@@ -17,6 +17,16 @@
 
 #include <GLFW/glfw3.h>
 
+#include "ofProtonectFaceTopology.h"
+#include "ofProtonectFrameGraph.h"
+#include "ofProtonectFrameFileReader.h"
+#include "ofProtonectFrameFileWriter.h"
+#include "ofProtonectFrameListener.h"
+#include "ofProtonectImageConversion.h"
+#include "ofProtonectPointCloudKernel.h"
+#include "ofProtonectTimings.h"
+#include "ofProtonectWorkerPool.h"
+
 class ofProtonect
 {
 public:
@@ -33,26 +43,269 @@ public:
 #endif
     };
 
+    enum class StreamMode
+    {
+        /// Wait until a color and a depth frame arrived, like libfreenect2's
+        /// SyncMultiFrameListener.
+        SYNCHRONIZED,
+        /// Color and depth arrive on separate queues. Frames are produced at
+        /// the depth rate and carry the latest color frame available.
+        DEPTH_DRIVEN
+    };
+
+    enum class ReplayMode
+    {
+        /// Deliver recorded frames at the rate they were captured.
+        REALTIME,
+        /// Deliver recorded frames as fast as they can be processed.
+        AS_FAST_AS_POSSIBLE
+    };
+
+    enum class OrganizedPointCloud
+    {
+        /// Don't compute it.
+        NONE,
+        /// x, y and z per depth pixel.
+        XYZ,
+        /// x, y, z and the registered color packed like in PCL.
+        XYZRGB
+    };
+
+    /// \brief The outputs derived from the decoded frames.
+    enum class Output
+    {
+        /// FrameSet::registeredPixels.
+        REGISTERED,
+        /// FrameSet::undistorted, for world coordinate queries.
+        UNDISTORTED,
+        /// FrameSet::pointCloud and its faces.
+        POINT_CLOUD,
+        /// FrameSet::organizedPointCloud.
+        ORGANIZED_POINT_CLOUD,
+        /// FrameSet::distancePixels.
+        DISTANCE,
+        /// FrameSet::depthPixels.
+        DEPTH_PIXELS,
+        /// FrameSet::irPixels.
+        IR_PIXELS,
+        NUM_OUTPUTS
+    };
+
+    /// \brief Everything a single pass of updateKinect() produces.
+    struct FrameSet
+    {
+        ofPixels pixels;
+        ofPixels registeredPixels;
+        ofFloatPixels rawDepthPixels;
+        ofFloatPixels rawIRPixels;
+
+        /// \brief rawDepthPixels mapped to 8 bit, near is bright.
+        ofPixels depthPixels;
+        /// \brief The range depthPixels was mapped with in millimeters.
+        float depthPixelsMinDistance = 0;
+        float depthPixelsMaxDistance = 0;
+
+        /// \brief rawIRPixels mapped to 8 bit.
+        ofPixels irPixels;
+        /// \brief The distance of every depth pixel from the camera in millimeters.
+        ofFloatPixels distancePixels;
+        ofVboMesh pointCloud;
+
+        /// \brief The point cloud as an image, one point per depth pixel.
+        ofFloatPixels organizedPointCloud;
+
+        /// \brief The decoded frames the pixels above point into.
+        ofProtonectFrameListener::FrameMap frames;
+
+        /// \brief Registration output for this frame.
+        std::unique_ptr<libfreenect2::Frame> undistorted;
+        std::unique_ptr<libfreenect2::Frame> registered;
+
+        /// \brief Whether undistorted holds this frame's depth.
+        bool undistortedValid = false;
+
+        /// \brief Drop the decoded frames and the pixels that point into them.
+        ///
+        /// Held frames count towards the frame pool size, so a FrameSet that
+        /// isn't used should release them.
+        void releaseFrames();
+    };
+
     ofProtonect();
     
     int open(const std::string& serial,
              PacketPipelineType packetPipelineType = PacketPipelineType::OPENCL, int device = 0);
-    
 
-    void updateKinect(ofPixels& rgbPixels,
-                      ofPixels& rgbRegisteredPixels,
-                      ofFloatPixels& depthPixels,
-                      ofFloatPixels& irPixels,
-                      ofFloatPixels& distancePixels);
+    /// \brief Play back a recording made of libfreenect2 packet files.
+    ///
+    /// The directory holds files named <prefix>_<timestamp>_<sequence>.<suffix>
+    /// with a suffix of depth, jpg or jpeg, as read by libfreenect2::Freenect2Replay.
+    /// The packets go through the same decoding, registration and point cloud
+    /// code as a live device. Recorded depth frames are never dropped. Color is
+    /// delivered on a separate queue like in StreamMode::DEPTH_DRIVEN and each
+    /// depth frame gets the latest color frame, so color frames that arrive
+    /// faster than depth ones may be dropped.
+    /// The camera parameters are read from a <prefix>.params file written by
+    /// ofProtonectPacketRecorder, if there is one. The depth is decoded with
+    /// libfreenect2's default tables, not the recorded ones.
+    /// \returns 0 on success.
+    int openReplay(const std::string& directory,
+                   PacketPipelineType packetPipelineType = PacketPipelineType::OPENCL,
+                   ReplayMode mode = ReplayMode::REALTIME,
+                   int device = 0);
+
+    /// \brief Play back a file of decoded frames, see ofProtonectFrameFile.
+    ///
+    /// The file is memory mapped and its frames are used in place. Recorded
+    /// registered color is passed through instead of being registered again,
+    /// the color pixels are the registered ones then.
+    /// \param loop Start over at the end of the file.
+    /// \returns 0 on success.
+    int openFrameFile(const std::string& path,
+                      ReplayMode mode = ReplayMode::REALTIME,
+                      bool loop = true);
+
+    /// \returns the file being played back to seek in it, nullptr if there is none.
+    ofProtonectFrameFileReader* getFrameFile();
 
-	void updateKinect(ofPixels& rgbPixels,
-		ofPixels& rgbRegisteredPixels,
-		ofFloatPixels& depthPixels,
-		ofFloatPixels& irPixels,
-		ofFloatPixels& distancePixels, std::vector<glm::vec3>& pcVerts, std::vector<ofDefaultColorType>& pcColors, std::vector<ofIndexType>& pcIndicies,  std::vector<glm::vec2>& pcTexCoords,int steps, float minDistance, float maxDistance, float facesMaxLength);
+    /// \brief Start writing the decoded frames to a frame file.
+    ///
+    /// Records depth, IR and registered color as far as they are enabled.
+    /// Frames are copied on the processing thread and written by a thread of
+    /// the writer, which holds the processing thread up only when the disk
+    /// falls behind.
+    /// \param path The file to write, replaced if it exists.
+    /// \param recordPointCloud Also record an organized point cloud, this needs
+    ///        registration or the point cloud to be enabled.
+    /// \returns true if the file was created.
+    bool startRecording(const std::string& path, bool recordPointCloud = false);
+
+    /// \brief Finish the frame file being recorded.
+    void stopRecording();
+
+    bool isRecording() const;
+
+    /// \brief Open any frame source, e.g. an ofProtonectSyntheticDevice.
+    ///
+    /// Frames go through the same listeners, registration and point cloud
+    /// code as frames from a sensor.
+    /// \param frameSource The source to read from, ofProtonect takes ownership.
+    /// \returns 0 on success.
+    int open(libfreenect2::Freenect2Device* frameSource);
+    
+
+    /// \brief Wait for the next frame and fill every enabled output of frameSet.
+    /// \returns false if no frame arrived, frameSet is left untouched then.
+    bool updateKinect(FrameSet& frameSet, int steps, float minDistance, float maxDistance, float facesMaxLength);
 
     int closeKinect();
 
+    /// \brief Make a waiting updateKinect() return false right away.
+    ///
+    /// Every updateKinect() fails from then on until the next open, so the
+    /// processing thread can be stopped without waiting for a frame that may
+    /// never come. Can be called from any thread.
+    void cancelWait();
+
+    /// \returns the per stage latencies of this device.
+    ofProtonectTimings& getTimings();
+    const ofProtonectTimings& getTimings() const;
+
+    /// \returns the number of decoded frames dropped because the frame pool was exhausted.
+    uint64_t getNumDroppedFrames() const;
+
+    /// \brief Set how many decoded frames of each type may be alive at once.
+    ///
+    /// Frames held through FrameSets count towards this. Takes effect on the next open().
+    void setFramePoolSize(std::size_t size);
+    std::size_t getFramePoolSize() const;
+
+    /// \brief Only compute a vertex for every steps-th row and column.
+    ///
+    /// With NONE steps only spaces the faces, the point cloud keeps a vertex
+    /// per depth pixel. Otherwise each steps x steps block becomes a single
+    /// vertex, which has the texture coordinate and color of the top left
+    /// pixel of its block.
+    void setPointCloudDecimation(ofProtonectPointCloudKernel::Decimation decimation);
+    ofProtonectPointCloudKernel::Decimation getPointCloudDecimation() const;
+
+    /// \brief Note that an output is being read. Can be called from any thread.
+    ///
+    /// The distance image, the 8 bit images and the undistorted depth are
+    /// computed from then on even if they weren't enabled.
+    void requestOutput(Output output);
+
+    /// \brief Only compute outputs that were requested recently.
+    ///
+    /// Otherwise every enabled output is computed for every frame. Demand
+    /// driven, an enabled output is skipped once it hasn't been requested for
+    /// numFrames frames, so outputs nobody reads cost nothing. Whoever reads
+    /// the FrameSet has to call requestOutput() for what it reads.
+    /// \param demandDriven Whether to skip outputs that aren't requested.
+    /// \param numFrames How many frames a request lasts.
+    void setDemandDriven(bool demandDriven, uint64_t numFrames = 30);
+    bool isDemandDriven() const;
+
+    /// \brief Also map the depth to 8 bit in FrameSet::depthPixels.
+    ///
+    /// Can be changed from any thread, it takes effect on the next frame.
+    void setUseDepthPixels(bool useDepth);
+    bool getUseDepthPixels() const;
+
+    /// \brief Also map the IR to 8 bit in FrameSet::irPixels.
+    ///
+    /// Can be changed from any thread, it takes effect on the next frame.
+    void setUseIrPixels(bool useIr);
+    bool getUseIrPixels() const;
+
+    /// \brief The IR value FrameSet::irPixels maps to white.
+    static constexpr float IR_PIXELS_MAX_VALUE = 4500;
+
+    /// \brief Also compute the distance image of the undistorted depth.
+    ///
+    /// Can be changed from any thread, it takes effect on the next frame.
+    void setUseDistancePixels(bool useDistance);
+    bool getUseDistancePixels() const;
+
+    /// \brief Also compute the point cloud as a 512x424 image of floats.
+    ///
+    /// Each pixel holds the coordinates the point cloud vertex of that depth
+    /// pixel has at full resolution, NaN where the depth is invalid or out of
+    /// range. XYZRGB adds a fourth channel with the registered color.
+    void setOrganizedPointCloud(OrganizedPointCloud mode);
+    OrganizedPointCloud getOrganizedPointCloud() const;
+
+    /// \brief Leave points without valid depth in range out of the point cloud.
+    ///
+    /// Otherwise the point cloud is organized: every depth pixel has a vertex,
+    /// NaN for invalid depth or depth outside [minDistance, maxDistance].
+    /// Compacted, the mesh only holds the valid points and its faces index
+    /// those. Texture coordinates then are the pixel of each point.
+    void setCompactPointCloud(bool compact);
+    bool getCompactPointCloud() const;
+
+    /// \brief Only compute the point cloud vertices, without colors or texture coordinates.
+    ///
+    /// The point cloud then is made from the undistorted depth alone, so
+    /// nothing gets registered for it and the color stream isn't needed.
+    void setPointCloudGeometryOnly(bool geometryOnly);
+    bool getPointCloudGeometryOnly() const;
+
+    /// \brief Set the threads the point cloud and its faces are computed on.
+    ///
+    /// Defaults to ofProtonectWorkerPool::getShared(), nullptr computes them
+    /// on the calling thread only. The results are the same either way.
+    void setWorkerPool(ofProtonectWorkerPool* pool);
+    ofProtonectWorkerPool* getWorkerPool() const;
+
+    /// \brief Choose how color and depth are paired. Takes effect on the next open().
+    void setStreamMode(StreamMode mode);
+    StreamMode getStreamMode() const;
+
+    /// \brief In DEPTH_DRIVEN mode, the oldest color frame still attached to a depth frame.
+    /// \param lag Age in libfreenect2 timestamp units (0.125 ms).
+    void setMaxColorLag(uint32_t lag);
+
 
     libfreenect2::Freenect2& getFreenect2Instance()
     {
@@ -61,7 +314,21 @@ public:
     void setUsePointCloud(bool _usePointCloud);
     void setRegisterImages(bool _registerImages);
     void setIsPointCloudFilled(bool _pointCloudFilled);
+
+    /// \brief Start or stop the color and the depth stream.
+    ///
+    /// Can be called from any thread. While open, the streams are restarted
+    /// and the frame listeners rebuilt at the start of the next updateKinect(),
+    /// so stopped streams are neither transferred nor decoded. A sensor has to
+    /// be opened again to restart its depth stream, which takes a moment, so
+    /// while depth keeps streaming turning color off only ignores its frames.
+    /// Streams a replay or frame file doesn't have stay off.
+    void setStreams(bool rgb, bool depth);
+
+    /// \brief Start or stop the color stream, see setStreams().
     void setUseRgb(bool _enableRGB);
+
+    /// \brief Start or stop the depth and IR stream, see setStreams().
     void setUseDepth(bool _enableDepth);
     void setUseIr(bool _enableIr);
     void setPointCloudTexCoord(bool _useTexCoords);
@@ -78,17 +345,167 @@ public:
 	int getPointCloudAlpha();
 	bool getTransformPointCloud();
     
+    /// \brief Color camera settings, see libfreenect2::Freenect2Device.
+    ///
+    /// They are remembered and applied again whenever the device is opened,
+    /// also when it is reopened to restart its depth stream. Can be called
+    /// from any thread.
+    void setColorAutoExposure(float exposureCompensation = 0);
+    void setColorManualExposure(float integrationTimeMs, float analogGain);
+    void setColorSetting(libfreenect2::ColorSettingCommandType cmd, uint32_t value);
+    void setColorSetting(libfreenect2::ColorSettingCommandType cmd, float value);
+
+    /// \brief Apply the remembered color settings to the device again.
     void setColorCamSettings();
 
+    /// \returns true if restarting the streams failed, updateKinect() fails
+    /// then until the device is closed and opened again.
+    bool hasFailed() const;
+
 	void setTransformationMatrix(ofMatrix4x4 _mat);
 	
 
 protected:
+    /// \returns a new pipeline, nullptr for the default one.
+    static libfreenect2::PacketPipeline* createPipeline(PacketPipelineType packetPipelineType, int device);
+
+    /// \returns the timestamp encoded in a replay file name, -1 if it has none.
+    static int64_t getReplayTimestamp(const std::string& filename);
+
+    /// \brief Sleep until a replayed frame is due.
+    void paceReplayFrame(const ofProtonectFrameListener::FrameMap& frames);
+
+    /// \brief Append a frame to the frame file being recorded, if any.
+    void recordFrame(const libfreenect2::Frame* depth,
+                     const libfreenect2::Frame* ir,
+                     const libfreenect2::Frame* registered,
+                     const libfreenect2::Frame* undistorted);
+
+    /// \returns the number of threads parallelFor() runs on.
+    std::size_t getConcurrency() const;
+
+    /// \brief Run task(0) ... task(numTasks - 1) on the worker pool, if any.
+    void parallelFor(std::size_t numTasks, const std::function<void(std::size_t)>& task);
+
+    /// \returns true if an output was ever requested.
+    bool wasRequested(Output output) const;
+
+    /// \returns false if demand driven and the output wasn't requested recently.
+    bool isWanted(Output output) const;
+
+    /// \brief Set the frame listeners up for the streams and start them.
+    /// \returns false if the streams couldn't be started.
+    bool startStreams(bool rgb, bool depth);
+
+    /// \brief Stop all streams and free the frame listeners.
+    void stopStreams();
+
+    /// \brief Stop and close the frame source and reset what was set up for it.
+    ///
+    /// Used by closeKinect() and when opening fails half way.
+    void closeDevice();
+
+    /// \brief Restart the streams if setStreams() changed them, on the processing thread.
+    /// \returns false if the device couldn't be restarted, hasFailed() is true then.
+    bool updateStreams();
+
+    /// \brief Make the listeners ignore color frames, or take them again.
+    void setColorIgnored(bool ignored);
+
+    /// \brief Remember a color setting and apply it to the device.
+    /// \param key Identifies the setting, a later one with the same key replaces it.
+    void applyColorSetting(int key, std::function<void(libfreenect2::Freenect2Device*)> apply);
+
+    /// \brief Add the most recent color frame to frames, unless it is too old.
+    void attachLatestColorFrame(ofProtonectFrameListener::FrameMap& frames);
+
+    /// \brief The steps of processing a frame, the nodes of frameGraph.
+    enum class Node
+    {
+        /// Undistort the depth, and register the color if REGISTER is scheduled.
+        UNDISTORT,
+        /// Provide the registered color.
+        REGISTER,
+        /// Wrap the decoded frames in FrameSet pixels.
+        PIXELS,
+        /// Append the frame to the frame file being recorded.
+        RECORD,
+        DISTANCE,
+        ORGANIZED_POINT_CLOUD,
+        DEPTH_PIXELS,
+        IR_PIXELS,
+        POINT_CLOUD,
+        FACES,
+        NUM_NODES
+    };
+
+    static ofProtonectFrameGraph::NodeSet toSet(Node node);
+    static std::size_t toId(Node node);
+
+    /// \brief Add the nodes and the inputs that never change.
+    void setupFrameGraph();
+
+    /// \brief Record the time the nodes of a stage took, if any was scheduled.
+    void recordNodeTimings(ofProtonectTimings::Stage stage, ofProtonectFrameGraph::NodeSet nodes);
+
+    void processUndistort();
+    void processRegister();
+    void processPixels();
+    void processRecord();
+    void processDistance();
+    void processOrganizedPointCloud();
+    void processDepthPixels();
+    void processIrPixels();
+    void processPointCloud();
+    void processFaces();
+
+    /// \brief What the nodes work on while updateKinect() processes a frame.
+    struct FrameState
+    {
+        FrameSet* frameSet = nullptr;
+        libfreenect2::Frame* rgb = nullptr;
+        libfreenect2::Frame* ir = nullptr;
+        libfreenect2::Frame* depth = nullptr;
+        libfreenect2::Frame* undistorted = nullptr;
+        libfreenect2::Frame* registered = nullptr;
+        bool undistortedValid = false;
+        bool registeredValid = false;
+
+        // The settings read once for the frame.
+        int steps = 1;
+        float minDistance = 0;
+        float maxDistance = 0;
+        float facesMaxLength = 0;
+        bool registerImages = false;
+        bool useRegistered = false;
+        OrganizedPointCloud organizedPointCloud = OrganizedPointCloud::NONE;
+        bool compact = false;
+        bool geometryOnly = false;
+
+        // The point cloud grid the faces are made from, nullptr if there is none.
+        const std::vector<glm::vec3>* gridVertices = nullptr;
+        int gridWidth = 0;
+        int gridHeight = 0;
+        bool decimated = false;
+    };
+
     ofPixelFormat rgbFormat;
     
-    bool enableRGB = true;
+    std::atomic<bool> enableRGB;
     bool enableIr = true;
-    bool enableDepth = true;
+    std::atomic<bool> enableDepth;
+    // Set when enableRGB or enableDepth changed since the streams were started.
+    std::atomic<bool> streamsChanged;
+    bool streamingRGB = false;
+    bool streamingDepth = false;
+    // Color is still transferred but its frames aren't taken.
+    bool colorIgnored = false;
+    // The IR stream can't be started again on the same device handle.
+    bool irStarted = false;
+    std::atomic<bool> deviceFailed;
+    // The streams the frame source has, replays and frame files may lack one.
+    bool colorAvailable = true;
+    bool depthAvailable = true;
     bool usePointCloud =true;
     bool registerImages = true;
     bool pointCloudFilled = true;
@@ -101,17 +518,83 @@ protected:
     bool bOpened = false;
 	ofMatrix4x4 pointCloudTransformationMat;
     libfreenect2::Freenect2 freenect2;
+    std::unique_ptr<libfreenect2::Freenect2Replay> replay;
+
+    bool paceReplay = false;
+    bool replayStarted = false;
+    uint32_t replayStartTimestamp = 0;
+    std::chrono::steady_clock::time_point replayStartTime;
+
+    // Owned through dev while a frame file is played back.
+    ofProtonectFrameFileReader* frameFile = nullptr;
+    bool colorIsRegistered = false;
+
+    mutable std::mutex recordingMutex;
+    ofProtonectFrameFileWriter recording;
+    std::vector<float> recordingPointCloud;
 
     libfreenect2::Freenect2Device* dev = nullptr;
     libfreenect2::PacketPipeline* pipeline = nullptr;
+    // Guards dev against other threads while it is opened again or closed.
+    mutable std::mutex deviceMutex;
+    // The color settings in the order they were made, one per key.
+    std::vector<std::pair<int, std::function<void(libfreenect2::Freenect2Device*)>>> colorSettings;
+
+    // How a sensor was opened, to open it again. Empty for other frame sources.
+    std::string deviceSerial;
+    PacketPipelineType devicePipelineType = PacketPipelineType::DEFAULT;
+    int devicePipelineDevice = 0;
 
-    libfreenect2::FrameMap frames;
+    std::size_t framePoolSize = 6;
+    ofProtonectTimings timings;
+    StreamMode streamMode = StreamMode::SYNCHRONIZED;
+    uint32_t maxColorLag = 8 * 250;
 
     libfreenect2::Registration* registration = nullptr;
-    libfreenect2::SyncMultiFrameListener* listener = nullptr;
-    libfreenect2::Frame* undistorted = nullptr;
-    libfreenect2::Frame* registered = nullptr;
-    libfreenect2::Frame* bigFrame = nullptr;
+    ofProtonectPointCloudKernel pointCloudKernel;
+
+    // The vertices are computed in bands of rows of this height.
+    static const std::size_t ROWS_PER_BAND = 32;
+    ofProtonectWorkerPool* workerPool = &ofProtonectWorkerPool::getShared();
+    std::atomic<bool> demandDriven;
+    std::atomic<uint64_t> demandFrames;
+    // Counts the frames processed, requests are stamped with it.
+    std::atomic<uint64_t> frameCount;
+    std::atomic<uint64_t> lastRequests[static_cast<std::size_t>(Output::NUM_OUTPUTS)];
+    static const uint64_t NEVER_REQUESTED = std::numeric_limits<uint64_t>::max();
+
+    std::atomic<bool> useDepthPixels;
+    std::atomic<bool> useIrPixels;
+    std::atomic<bool> useDistancePixels;
+    OrganizedPointCloud organizedPointCloud = OrganizedPointCloud::NONE;
+    ofProtonectPointCloudKernel::Decimation pointCloudDecimation = ofProtonectPointCloudKernel::Decimation::NONE;
+    ofProtonectPointCloudKernel decimatedKernel;
+    std::vector<float> decimatedDepth;
+    std::vector<unsigned char> decimatedRegistered;
+
+    bool compactPointCloud = false;
+    bool pointCloudGeometryOnly = false;
+    // The organized point cloud when it is compacted into the mesh.
+    std::vector<glm::vec3> compactionVertices;
+    std::vector<ofFloatColor> compactionColors;
+    // Where each pixel went in the mesh, INVALID_INDEX if it was dropped.
+    std::vector<ofIndexType> compactionRemap;
+    std::vector<std::size_t> compactionOffsets;
+    static const ofIndexType INVALID_INDEX = std::numeric_limits<ofIndexType>::max();
+
+    ofProtonectFrameGraph frameGraph;
+    FrameState frameState;
+
+    ofProtonectFaceTopology faceTopology;
+    // Room for every candidate triangle, filled in bands of rows.
+    std::vector<ofIndexType> faceBuffer;
+    std::vector<std::size_t> faceBandOffsets;
+    ofProtonectFrameListener* listener = nullptr;
+    ofProtonectFrameListener* colorListener = nullptr;
+    // Guards the listeners against cancelWait(), they only change on the processing thread.
+    std::mutex listenerMutex;
+    std::atomic<bool> waitCancelled;
+    ofProtonectFrameListener::FrameMap latestColorFrames;
 
 
 
@@ -0,0 +1,331 @@
+//  ofProtonectDepthCodec.cpp
+
+
+#include "ofProtonectDepthCodec.h"
+
+
+#include <cstring>
+
+
+namespace
+{
+    const std::size_t HEADER_SIZE = sizeof(uint32_t);
+
+    inline uint16_t quantizeValue(float value)
+    {
+        // Branch free so it vectorizes, the comparison also rejects NaN.
+        float rounded = value + 0.5f;
+        rounded = (rounded >= 1.0f && rounded < 65536.0f) ? rounded : 0.0f;
+        return static_cast<uint16_t>(static_cast<int32_t>(rounded));
+    }
+
+    /// Writes nibbles into 32 bit words, most significant nibble first.
+    class NibbleWriter
+    {
+    public:
+        NibbleWriter(uint32_t* _words): words(_words)
+        {
+        }
+
+        /// Three bits per nibble, least significant first. The fourth bit
+        /// marks that more follow.
+        inline void writeVariableLength(uint32_t value)
+        {
+            // Assemble all nibbles of the value in the order they are
+            // written, then append them at once.
+            uint64_t code = value & 0x7;
+            int numValueNibbles = 1;
+            value >>= 3;
+
+            while (value)
+            {
+                code = ((code | 0x8) << 4) | (value & 0x7);
+                numValueNibbles++;
+                value >>= 3;
+            }
+
+            if (numValueNibbles > 8)
+            {
+                // Only long runs get here, keep pending within 64 bits.
+                append(code >> 32, numValueNibbles - 8);
+                append(code & 0xffffffff, 8);
+            }
+            else
+            {
+                append(code, numValueNibbles);
+            }
+        }
+
+        /// \returns the end of the written words.
+        uint32_t* flush()
+        {
+            if (numPending > 0)
+            {
+                *words++ = static_cast<uint32_t>(pending << (4 * (8 - numPending)));
+                numPending = 0;
+            }
+
+            return words;
+        }
+
+    private:
+        inline void append(uint64_t nibbles, int numNibbles)
+        {
+            pending = (pending << (4 * numNibbles)) | nibbles;
+            numPending += numNibbles;
+
+            if (numPending >= 8)
+            {
+                numPending -= 8;
+                *words++ = static_cast<uint32_t>(pending >> (4 * numPending));
+            }
+        }
+
+        uint32_t* words;
+        uint64_t pending = 0;
+        int numPending = 0;
+    };
+
+    class NibbleReader
+    {
+    public:
+        NibbleReader(const uint32_t* _words, const uint32_t* _end): words(_words), end(_end)
+        {
+        }
+
+        /// \returns false if the data ends early or the value doesn't fit.
+        inline bool readVariableLength(uint32_t& value)
+        {
+            value = 0;
+            int shift = 0;
+            uint32_t nibble;
+
+            do
+            {
+                if (numNibbles == 0)
+                {
+                    if (words == end)
+                    {
+                        return false;
+                    }
+
+                    word = *words++;
+                    numNibbles = 8;
+                }
+
+                nibble = word >> 28;
+                word <<= 4;
+                numNibbles--;
+
+                if (shift > 30)
+                {
+                    return false;
+                }
+
+                value |= (nibble & 0x7) << shift;
+                shift += 3;
+            }
+            while (nibble & 0x8);
+
+            return true;
+        }
+
+    private:
+        const uint32_t* words;
+        const uint32_t* end;
+        uint32_t word = 0;
+        int numNibbles = 0;
+    };
+
+    std::size_t encodeImage(const uint16_t* values, std::size_t numPixels, std::vector<unsigned char>& encoded)
+    {
+        // Encode into scratch space large enough for any image, so only the
+        // encoded bytes have to be written to the output.
+        thread_local std::vector<uint32_t> scratch;
+        scratch.resize((ofProtonectDepthCodec::getMaxEncodedSize(numPixels) - HEADER_SIZE) / sizeof(uint32_t));
+
+        NibbleWriter writer(scratch.data());
+
+        const uint16_t* value = values;
+        const uint16_t* end = values + numPixels;
+        int32_t previous = 0;
+
+        while (value != end)
+        {
+            const uint16_t* zerosStart = value;
+
+            while (value != end && *value == 0)
+            {
+                value++;
+            }
+
+            writer.writeVariableLength(static_cast<uint32_t>(value - zerosStart));
+
+            const uint16_t* nonZerosStart = value;
+
+            while (value != end && *value != 0)
+            {
+                value++;
+            }
+
+            writer.writeVariableLength(static_cast<uint32_t>(value - nonZerosStart));
+
+            for (const uint16_t* nonZero = nonZerosStart; nonZero != value; nonZero++)
+            {
+                int32_t current = *nonZero;
+                int32_t delta = current - previous;
+
+                // Zigzag, so small negative deltas stay short.
+                writer.writeVariableLength((static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+                previous = current;
+            }
+        }
+
+        std::size_t wordsSize = (writer.flush() - scratch.data()) * sizeof(uint32_t);
+        uint32_t header = static_cast<uint32_t>(numPixels);
+
+        encoded.resize(HEADER_SIZE + wordsSize);
+        std::memcpy(encoded.data(), &header, HEADER_SIZE);
+        std::memcpy(encoded.data() + HEADER_SIZE, scratch.data(), wordsSize);
+
+        return encoded.size();
+    }
+
+    template<typename T>
+    bool decodeImage(const unsigned char* encoded, std::size_t size, T* values, std::size_t numPixels)
+    {
+        if (ofProtonectDepthCodec::getNumPixels(encoded, size) != numPixels || numPixels == 0)
+        {
+            return false;
+        }
+
+        // Copy unaligned input, the words are read in place otherwise.
+        std::vector<uint32_t> aligned;
+        const uint32_t* words = reinterpret_cast<const uint32_t*>(encoded + HEADER_SIZE);
+        std::size_t numWords = (size - HEADER_SIZE) / sizeof(uint32_t);
+
+        if (reinterpret_cast<std::uintptr_t>(words) % alignof(uint32_t) != 0)
+        {
+            aligned.resize(numWords);
+            std::memcpy(aligned.data(), encoded + HEADER_SIZE, numWords * sizeof(uint32_t));
+            words = aligned.data();
+        }
+
+        NibbleReader reader(words, words + numWords);
+
+        T* value = values;
+        T* end = values + numPixels;
+        int32_t previous = 0;
+
+        while (value != end)
+        {
+            uint32_t numZeros;
+            uint32_t numNonZeros;
+
+            if (!reader.readVariableLength(numZeros) || numZeros > std::size_t(end - value))
+            {
+                return false;
+            }
+
+            for (T* last = value + numZeros; value != last; value++)
+            {
+                *value = 0;
+            }
+
+            if (!reader.readVariableLength(numNonZeros) || numNonZeros > std::size_t(end - value))
+            {
+                return false;
+            }
+
+            for (T* last = value + numNonZeros; value != last; value++)
+            {
+                uint32_t zigzag;
+
+                if (!reader.readVariableLength(zigzag))
+                {
+                    return false;
+                }
+
+                int32_t delta = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+                int32_t current = previous + delta;
+
+                if (current <= 0 || current > 65535)
+                {
+                    return false;
+                }
+
+                *value = static_cast<T>(current);
+                previous = current;
+            }
+
+            if (numZeros == 0 && numNonZeros == 0)
+            {
+                // Only the end of the image may be empty.
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+
+std::size_t ofProtonectDepthCodec::getMaxEncodedSize(std::size_t numPixels)
+{
+    // Per pixel at most six nibbles for its value plus one for the run it is
+    // part of, and a nibble for each of the two runs that may be empty.
+    std::size_t maxNibbles = 8 * numPixels + 2;
+    return HEADER_SIZE + (maxNibbles + 7) / 8 * sizeof(uint32_t);
+}
+
+
+std::size_t ofProtonectDepthCodec::encode(const uint16_t* values, std::size_t numPixels, std::vector<unsigned char>& encoded)
+{
+    return encodeImage(values, numPixels, encoded);
+}
+
+
+std::size_t ofProtonectDepthCodec::encode(const float* values, std::size_t numPixels, std::vector<unsigned char>& encoded)
+{
+    thread_local std::vector<uint16_t> quantized;
+    quantized.resize(numPixels);
+
+    quantize(values, numPixels, quantized.data());
+
+    return encodeImage(quantized.data(), numPixels, encoded);
+}
+
+
+bool ofProtonectDepthCodec::decode(const unsigned char* encoded, std::size_t size, uint16_t* values, std::size_t numPixels)
+{
+    return decodeImage(encoded, size, values, numPixels);
+}
+
+
+bool ofProtonectDepthCodec::decode(const unsigned char* encoded, std::size_t size, float* values, std::size_t numPixels)
+{
+    return decodeImage(encoded, size, values, numPixels);
+}
+
+
+std::size_t ofProtonectDepthCodec::getNumPixels(const unsigned char* encoded, std::size_t size)
+{
+    if (!encoded || size < HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    uint32_t numPixels;
+    std::memcpy(&numPixels, encoded, HEADER_SIZE);
+
+    return numPixels;
+}
+
+
+void ofProtonectDepthCodec::quantize(const float* values, std::size_t numPixels, uint16_t* quantized)
+{
+    for (std::size_t i = 0; i < numPixels; i++)
+    {
+        quantized[i] = quantizeValue(values[i]);
+    }
+}
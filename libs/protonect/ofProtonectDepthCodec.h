@@ -0,0 +1,61 @@
+//  ofProtonectDepthCodec.h
+//
+//  Fast lossless compression of depth and IR images.
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/// \brief Compresses 16 bit depth and IR images with RVL.
+///
+/// RVL (Wilson, "Fast Lossless Depth Image Compression", 2017) codes runs of
+/// invalid zero pixels and the zigzagged differences between neighbouring
+/// valid pixels with variable length nibbles. It needs a single pass and no
+/// tables, which makes it fast enough to run on every frame.
+///
+/// libfreenect2 decodes depth to float millimeters and IR to float values in
+/// [0, 65535]. The float functions round those to whole units, so they are
+/// lossless for the 16 bit values but drop the sub millimeter fraction, which
+/// is well below the sensor noise. Invalid depth (non positive, NaN or
+/// infinity) becomes 0.
+///
+/// An encoded image is the number of pixels as a uint32 followed by the RVL
+/// words, both in the byte order of the encoding machine.
+class ofProtonectDepthCodec
+{
+public:
+    /// \returns the largest number of bytes numPixels can encode to.
+    static std::size_t getMaxEncodedSize(std::size_t numPixels);
+
+    /// \brief Encode an image.
+    /// \param values The pixels to encode.
+    /// \param numPixels The number of pixels.
+    /// \param encoded Receives the encoded image, replacing its content.
+    /// \returns the number of encoded bytes.
+    static std::size_t encode(const uint16_t* values, std::size_t numPixels, std::vector<unsigned char>& encoded);
+
+    /// \brief Round float depth or IR to 16 bits and encode it.
+    static std::size_t encode(const float* values, std::size_t numPixels, std::vector<unsigned char>& encoded);
+
+    /// \brief Decode an image.
+    /// \param encoded The encoded image.
+    /// \param size The number of encoded bytes.
+    /// \param values Receives numPixels pixels.
+    /// \param numPixels The number of pixels expected.
+    /// \returns false if the data is malformed or holds a different number of pixels.
+    static bool decode(const unsigned char* encoded, std::size_t size, uint16_t* values, std::size_t numPixels);
+
+    /// \brief Decode an image to float depth or IR.
+    static bool decode(const unsigned char* encoded, std::size_t size, float* values, std::size_t numPixels);
+
+    /// \returns the number of pixels of an encoded image, 0 if it is malformed.
+    static std::size_t getNumPixels(const unsigned char* encoded, std::size_t size);
+
+    /// \brief Round float depth or IR to 16 bits.
+    static void quantize(const float* values, std::size_t numPixels, uint16_t* quantized);
+};
@@ -0,0 +1,122 @@
+//  ofProtonectFaceTopology.cpp
+
+
+#include "ofProtonectFaceTopology.h"
+
+
+#include <algorithm>
+#include <cmath>
+
+
+void ofProtonectFaceTopology::setup(int _width, int _height, int _steps)
+{
+    if (_width == width && _height == height && _steps == steps)
+    {
+        return;
+    }
+
+    width = _width;
+    height = _height;
+    steps = _steps;
+
+    // Same quads as for (i = 0; i < width - steps; i += steps).
+    numColumns = steps > 0 && width > steps ? (width - 1) / steps : 0;
+    numRows = steps > 0 && height > steps ? (height - 1) / steps : 0;
+
+    candidates.resize(numColumns * numRows * 6);
+
+    ofIndexType* candidate = candidates.data();
+
+    for (std::size_t row = 0; row < numRows; row++)
+    {
+        for (std::size_t column = 0; column < numColumns; column++)
+        {
+            const ofIndexType topLeft = static_cast<ofIndexType>(row * steps * width + column * steps);
+            const ofIndexType topRight = topLeft + steps;
+            const ofIndexType bottomLeft = topLeft + width * steps;
+            const ofIndexType bottomRight = bottomLeft + steps;
+
+            // The first vertex is tested against the other two.
+            *candidate++ = topLeft;
+            *candidate++ = bottomLeft;
+            *candidate++ = topRight;
+
+            *candidate++ = bottomRight;
+            *candidate++ = bottomLeft;
+            *candidate++ = topRight;
+        }
+    }
+}
+
+
+int ofProtonectFaceTopology::getWidth() const
+{
+    return width;
+}
+
+
+int ofProtonectFaceTopology::getHeight() const
+{
+    return height;
+}
+
+
+int ofProtonectFaceTopology::getSteps() const
+{
+    return steps;
+}
+
+
+std::size_t ofProtonectFaceTopology::getNumColumns() const
+{
+    return numColumns;
+}
+
+
+std::size_t ofProtonectFaceTopology::getNumRows() const
+{
+    return numRows;
+}
+
+
+std::size_t ofProtonectFaceTopology::getMaxIndicesPerRow() const
+{
+    return numColumns * 6;
+}
+
+
+std::size_t ofProtonectFaceTopology::computeFaces(const glm::vec3* vertices,
+                                                  float maxLength,
+                                                  std::size_t rowBegin,
+                                                  std::size_t rowEnd,
+                                                  ofIndexType* indices) const
+{
+    rowEnd = std::min(rowEnd, numRows);
+
+    if (rowBegin >= rowEnd)
+    {
+        return 0;
+    }
+
+    const ofIndexType* candidate = candidates.data() + rowBegin * numColumns * 6;
+    const ofIndexType* end = candidates.data() + rowEnd * numColumns * 6;
+    ofIndexType* index = indices;
+
+    for (; candidate != end; candidate += 3)
+    {
+        const float z0 = vertices[candidate[0]].z;
+        const float z1 = vertices[candidate[1]].z;
+        const float z2 = vertices[candidate[2]].z;
+
+        // Always write, only keep the triangle by advancing past it. NaN
+        // depth fails the comparisons like in the original loop.
+        const bool valid = std::abs(z0 - z2) < maxLength && std::abs(z0 - z1) < maxLength;
+
+        index[0] = candidate[0];
+        index[1] = candidate[1];
+        index[2] = candidate[2];
+        index += valid ? 3 : 0;
+    }
+
+    return index - indices;
+}
@@ -0,0 +1,67 @@
+//  ofProtonectFaceTopology.h
+//
+//  The triangles a point cloud grid can be meshed with, computed once.
+
+
+#pragma once
+
+
+#include "ofMain.h"
+
+
+/// \brief Meshes an organized point cloud into triangles.
+///
+/// Every quad of the grid, spaced steps pixels apart, is split into an upper
+/// left and a lower right triangle. Which vertices these are only depends on
+/// the grid size and steps, so setup() lists all candidate triangles once, in
+/// row-major order. Per frame computeFaces() only tests which candidates have
+/// short enough edges and compacts the surviving ones into the output.
+class ofProtonectFaceTopology
+{
+public:
+    /// \brief List the candidate triangles, does nothing if they didn't change.
+    /// \param width The width of the point cloud grid.
+    /// \param height The height of the point cloud grid.
+    /// \param steps The distance between the vertices of a quad in pixels.
+    void setup(int width, int height, int steps);
+
+    int getWidth() const;
+    int getHeight() const;
+    int getSteps() const;
+
+    /// \returns the number of quads per row.
+    std::size_t getNumColumns() const;
+
+    /// \returns the number of rows of quads.
+    std::size_t getNumRows() const;
+
+    /// \returns the largest number of indices computeFaces() writes for a row of quads.
+    std::size_t getMaxIndicesPerRow() const;
+
+    /// \brief Write the triangles whose vertices differ less than maxLength in depth.
+    ///
+    /// Rows of quads are independent, so ranges of them can be computed by
+    /// different threads at once.
+    /// \param vertices The grid of vertices.
+    /// \param maxLength The largest difference in z along the tested edges.
+    /// \param rowBegin The first row of quads.
+    /// \param rowEnd The row of quads after the last one.
+    /// \param indices Receives up to getMaxIndicesPerRow() indices per row.
+    /// \returns the number of indices written.
+    std::size_t computeFaces(const glm::vec3* vertices,
+                             float maxLength,
+                             std::size_t rowBegin,
+                             std::size_t rowEnd,
+                             ofIndexType* indices) const;
+
+private:
+    int width = 0;
+    int height = 0;
+    int steps = 0;
+
+    std::size_t numColumns = 0;
+    std::size_t numRows = 0;
+
+    // Six indices per quad, the upper left triangle then the lower right one.
+    std::vector<ofIndexType> candidates;
+};
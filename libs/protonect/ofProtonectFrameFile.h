@@ -0,0 +1,120 @@
+//  ofProtonectFrameFile.h
+//
+//  The layout of a file of recorded, decoded Kinect v2 frames.
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <cstring>
+
+#include <libfreenect2/libfreenect2.hpp>
+
+
+/// \brief Describes the single file container written by
+/// ofProtonectFrameFileWriter and read by ofProtonectFrameFileReader.
+///
+/// The file starts with a FileHeader holding the camera parameters, followed
+/// by frames of a fixed size each, so frame n starts at
+/// dataOffset + n * frameStride. Every frame starts with a FrameHeader and
+/// holds one block per recorded stream, in the order of the Stream flags.
+/// Frames are page aligned so they can be handed out as views into a memory
+/// mapping. Once the file is closed an index of the frame timestamps and
+/// sequence numbers is appended, files that were never closed are recovered
+/// from the frame headers.
+///
+/// All values are stored in the byte order of the recording machine.
+class ofProtonectFrameFile
+{
+public:
+    enum Stream: uint32_t
+    {
+        /// 512x424 float depth in millimeters, as decoded.
+        DEPTH = 1,
+        /// 512x424 float IR.
+        IR = 2,
+        /// 512x424 BGRX color registered to the depth image.
+        REGISTERED = 4,
+        /// 512x424 organized XYZ floats in meters, from the undistorted depth.
+        POINT_CLOUD = 8
+    };
+
+    static const std::size_t WIDTH = 512;
+    static const std::size_t HEIGHT = 424;
+    static const uint32_t VERSION = 1;
+    static const std::size_t PAGE_SIZE = 4096;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t streams;
+        uint32_t width;
+        uint32_t height;
+        uint64_t frameStride;
+        uint64_t dataOffset;
+        /// 0 until the file was closed.
+        uint64_t indexOffset;
+        uint64_t numFrames;
+        libfreenect2::Freenect2Device::IrCameraParams irParams;
+        libfreenect2::Freenect2Device::ColorCameraParams colorParams;
+    };
+
+    struct FrameHeader
+    {
+        uint32_t timestamp;
+        uint32_t sequence;
+        uint32_t streams;
+        uint32_t reserved[13];
+    };
+
+    struct IndexEntry
+    {
+        uint32_t timestamp;
+        uint32_t sequence;
+    };
+
+    /// \returns the size in bytes of one stream block.
+    static std::size_t getStreamSize(Stream stream)
+    {
+        return WIDTH * HEIGHT * (stream == POINT_CLOUD ? 3 * sizeof(float) : 4);
+    }
+
+    /// \returns the offset of a stream block from the start of its frame.
+    static std::size_t getStreamOffset(uint32_t streams, Stream stream)
+    {
+        std::size_t offset = sizeof(FrameHeader);
+
+        for (uint32_t flag = DEPTH; flag < stream; flag <<= 1)
+        {
+            if (streams & flag)
+            {
+                offset += getStreamSize(static_cast<Stream>(flag));
+            }
+        }
+
+        return offset;
+    }
+
+    /// \returns the size in bytes of a frame with the given streams.
+    static std::size_t getFrameStride(uint32_t streams)
+    {
+        return alignToPage(getStreamOffset(streams, static_cast<Stream>(POINT_CLOUD << 1)));
+    }
+
+    static std::size_t alignToPage(std::size_t size)
+    {
+        return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    }
+
+    static void setMagic(FileHeader& header)
+    {
+        std::memcpy(header.magic, "OFKV2REC", sizeof(header.magic));
+    }
+
+    static bool hasMagic(const FileHeader& header)
+    {
+        return std::memcmp(header.magic, "OFKV2REC", sizeof(header.magic)) == 0;
+    }
+};
@@ -0,0 +1,543 @@
+//  ofProtonectFrameFileReader.cpp
+
+
+#include "ofProtonectFrameFileReader.h"
+
+
+#include <algorithm>
+
+#ifdef TARGET_WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+    /// A frame that views memory of a mapping and keeps the mapping alive.
+    class MappedFrame: public libfreenect2::Frame
+    {
+    public:
+        MappedFrame(std::size_t width,
+                    std::size_t height,
+                    std::size_t bytesPerPixel,
+                    const unsigned char* data,
+                    std::shared_ptr<const void> _mapping):
+            libfreenect2::Frame(width, height, bytesPerPixel, const_cast<unsigned char*>(data)),
+            mapping(_mapping)
+        {
+        }
+
+    private:
+        std::shared_ptr<const void> mapping;
+    };
+}
+
+
+ofProtonectFrameFileReader::Mapping::~Mapping()
+{
+#ifdef TARGET_WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+#else
+    if (data) munmap(const_cast<unsigned char*>(data), size);
+#endif
+}
+
+
+ofProtonectFrameFileReader::ofProtonectFrameFileReader():
+    currentFrame(0),
+    seeked(false),
+    realtime(true),
+    loop(true),
+    paused(false)
+{
+    std::memset(&header, 0, sizeof(header));
+}
+
+
+ofProtonectFrameFileReader::~ofProtonectFrameFileReader()
+{
+    close();
+}
+
+
+bool ofProtonectFrameFileReader::load(const std::string& _path)
+{
+    close();
+
+    mapping.reset();
+    index = nullptr;
+    recoveredIndex.clear();
+    numFrames = 0;
+    currentFrame = 0;
+
+    path = _path;
+
+    std::shared_ptr<Mapping> newMapping = std::make_shared<Mapping>();
+
+#ifdef TARGET_WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        ofLogError("ofProtonectFrameFileReader::load") << "can't open " << path;
+        return false;
+    }
+
+    newMapping->file = file;
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < LONGLONG(sizeof(header)))
+    {
+        ofLogError("ofProtonectFrameFileReader::load") << "not a frame file " << path;
+        return false;
+    }
+
+    newMapping->size = fileSize.QuadPart;
+    newMapping->mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (newMapping->mapping)
+    {
+        newMapping->data = static_cast<const unsigned char*>(MapViewOfFile(newMapping->mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+
+    if (file < 0)
+    {
+        ofLogError("ofProtonectFrameFileReader::load") << "can't open " << path;
+        return false;
+    }
+
+    struct stat fileStat;
+
+    if (fstat(file, &fileStat) != 0 || fileStat.st_size < off_t(sizeof(header)))
+    {
+        ::close(file);
+        ofLogError("ofProtonectFrameFileReader::load") << "not a frame file " << path;
+        return false;
+    }
+
+    newMapping->size = fileStat.st_size;
+
+    void* data = mmap(nullptr, newMapping->size, PROT_READ, MAP_SHARED, file, 0);
+
+    // The mapping stays valid without the descriptor.
+    ::close(file);
+
+    if (data != MAP_FAILED)
+    {
+        newMapping->data = static_cast<const unsigned char*>(data);
+    }
+#endif
+
+    if (!newMapping->data)
+    {
+        ofLogError("ofProtonectFrameFileReader::load") << "can't map " << path;
+        return false;
+    }
+
+    std::memcpy(&header, newMapping->data, sizeof(header));
+
+    if (!ofProtonectFrameFile::hasMagic(header)
+        || header.version != ofProtonectFrameFile::VERSION
+        || header.width != ofProtonectFrameFile::WIDTH
+        || header.height != ofProtonectFrameFile::HEIGHT
+        || header.frameStride != ofProtonectFrameFile::getFrameStride(header.streams)
+        || header.dataOffset > newMapping->size)
+    {
+        ofLogError("ofProtonectFrameFileReader::load") << "not a frame file " << path;
+        return false;
+    }
+
+    uint64_t indexSize = header.numFrames * sizeof(ofProtonectFrameFile::IndexEntry);
+
+    if (header.indexOffset != 0
+        && header.indexOffset == header.dataOffset + header.numFrames * header.frameStride
+        && header.indexOffset + indexSize <= newMapping->size)
+    {
+        numFrames = header.numFrames;
+        index = reinterpret_cast<const ofProtonectFrameFile::IndexEntry*>(newMapping->data + header.indexOffset);
+    }
+    else
+    {
+        // The recording wasn't closed, keep the frames that were written completely.
+        numFrames = (newMapping->size - header.dataOffset) / header.frameStride;
+        recoveredIndex.resize(numFrames);
+
+        for (std::size_t i = 0; i < numFrames; i++)
+        {
+            const ofProtonectFrameFile::FrameHeader* frameHeader = reinterpret_cast<const ofProtonectFrameFile::FrameHeader*>(newMapping->data + header.dataOffset + i * header.frameStride);
+            recoveredIndex[i].timestamp = frameHeader->timestamp;
+            recoveredIndex[i].sequence = frameHeader->sequence;
+        }
+
+        index = recoveredIndex.data();
+
+        ofLogWarning("ofProtonectFrameFileReader::load") << path << " wasn't closed, recovered " << numFrames << " frames";
+    }
+
+    newMapping->zeros.assign(ofProtonectFrameFile::getStreamSize(ofProtonectFrameFile::DEPTH), 0);
+
+    mapping = newMapping;
+
+    return true;
+}
+
+
+bool ofProtonectFrameFileReader::isLoaded() const
+{
+    return mapping != nullptr;
+}
+
+
+uint32_t ofProtonectFrameFileReader::getStreams() const
+{
+    return mapping ? header.streams : 0;
+}
+
+
+std::size_t ofProtonectFrameFileReader::getNumFrames() const
+{
+    return numFrames;
+}
+
+
+uint32_t ofProtonectFrameFileReader::getTimestamp(std::size_t frame) const
+{
+    return frame < numFrames ? index[frame].timestamp : 0;
+}
+
+
+uint32_t ofProtonectFrameFileReader::getSequence(std::size_t frame) const
+{
+    return frame < numFrames ? index[frame].sequence : 0;
+}
+
+
+std::size_t ofProtonectFrameFileReader::findFrameByTimestamp(uint32_t timestamp) const
+{
+    const ofProtonectFrameFile::IndexEntry* found = std::lower_bound(index, index + numFrames, timestamp, [](const ofProtonectFrameFile::IndexEntry& entry, uint32_t value)
+    {
+        return entry.timestamp < value;
+    });
+
+    return found - index;
+}
+
+
+std::size_t ofProtonectFrameFileReader::findFrameBySequence(uint32_t sequence) const
+{
+    const ofProtonectFrameFile::IndexEntry* found = std::lower_bound(index, index + numFrames, sequence, [](const ofProtonectFrameFile::IndexEntry& entry, uint32_t value)
+    {
+        return entry.sequence < value;
+    });
+
+    if (found == index + numFrames || found->sequence != sequence)
+    {
+        return numFrames;
+    }
+
+    return found - index;
+}
+
+
+const unsigned char* ofProtonectFrameFileReader::getStream(std::size_t frame, ofProtonectFrameFile::Stream stream) const
+{
+    if (!mapping || frame >= numFrames || !(header.streams & stream))
+    {
+        return nullptr;
+    }
+
+    return mapping->data + header.dataOffset + frame * header.frameStride + ofProtonectFrameFile::getStreamOffset(header.streams, stream);
+}
+
+
+const float* ofProtonectFrameFileReader::getDepth(std::size_t frame) const
+{
+    return reinterpret_cast<const float*>(getStream(frame, ofProtonectFrameFile::DEPTH));
+}
+
+
+const float* ofProtonectFrameFileReader::getIr(std::size_t frame) const
+{
+    return reinterpret_cast<const float*>(getStream(frame, ofProtonectFrameFile::IR));
+}
+
+
+const unsigned char* ofProtonectFrameFileReader::getRegistered(std::size_t frame) const
+{
+    return getStream(frame, ofProtonectFrameFile::REGISTERED);
+}
+
+
+const float* ofProtonectFrameFileReader::getPointCloud(std::size_t frame) const
+{
+    return reinterpret_cast<const float*>(getStream(frame, ofProtonectFrameFile::POINT_CLOUD));
+}
+
+
+void ofProtonectFrameFileReader::seek(std::size_t frame)
+{
+    currentFrame = std::min(frame, numFrames > 0 ? numFrames - 1 : 0);
+    seeked = true;
+}
+
+
+std::size_t ofProtonectFrameFileReader::getCurrentFrame() const
+{
+    return currentFrame;
+}
+
+
+void ofProtonectFrameFileReader::setRealtime(bool _realtime)
+{
+    realtime = _realtime;
+    seeked = true;
+}
+
+
+void ofProtonectFrameFileReader::setLoop(bool _loop)
+{
+    loop = _loop;
+}
+
+
+void ofProtonectFrameFileReader::setPaused(bool _paused)
+{
+    paused = _paused;
+    seeked = true;
+}
+
+
+bool ofProtonectFrameFileReader::isPaused() const
+{
+    return paused;
+}
+
+
+libfreenect2::Frame* ofProtonectFrameFileReader::createFrame(std::size_t frame, ofProtonectFrameFile::Stream stream) const
+{
+    const unsigned char* data = getStream(frame, stream);
+
+    libfreenect2::Frame* result = new MappedFrame(ofProtonectFrameFile::WIDTH,
+                                                  ofProtonectFrameFile::HEIGHT,
+                                                  4,
+                                                  data ? data : mapping->zeros.data(),
+                                                  mapping);
+
+    result->timestamp = index[frame].timestamp;
+    result->sequence = index[frame].sequence;
+    result->format = stream == ofProtonectFrameFile::REGISTERED ? libfreenect2::Frame::BGRX : libfreenect2::Frame::Float;
+
+    return result;
+}
+
+
+void ofProtonectFrameFileReader::prefetch(std::size_t frame) const
+{
+#ifndef TARGET_WIN32
+    if (frame < numFrames)
+    {
+        unsigned char* start = const_cast<unsigned char*>(mapping->data + header.dataOffset + frame * header.frameStride);
+        madvise(start, header.frameStride, MADV_WILLNEED);
+    }
+#endif
+}
+
+
+std::string ofProtonectFrameFileReader::getSerialNumber()
+{
+    return ofFilePath::getFileName(path);
+}
+
+
+std::string ofProtonectFrameFileReader::getFirmwareVersion()
+{
+    return "frame file " + ofToString(header.version);
+}
+
+
+libfreenect2::Freenect2Device::ColorCameraParams ofProtonectFrameFileReader::getColorCameraParams()
+{
+    return header.colorParams;
+}
+
+
+libfreenect2::Freenect2Device::IrCameraParams ofProtonectFrameFileReader::getIrCameraParams()
+{
+    return header.irParams;
+}
+
+
+void ofProtonectFrameFileReader::setColorCameraParams(const ColorCameraParams& params)
+{
+    header.colorParams = params;
+}
+
+
+void ofProtonectFrameFileReader::setIrCameraParams(const IrCameraParams& params)
+{
+    header.irParams = params;
+}
+
+
+void ofProtonectFrameFileReader::setConfiguration(const Config& /*config*/)
+{
+}
+
+
+void ofProtonectFrameFileReader::setColorFrameListener(libfreenect2::FrameListener* listener)
+{
+    colorListener = listener;
+}
+
+
+void ofProtonectFrameFileReader::setIrAndDepthFrameListener(libfreenect2::FrameListener* listener)
+{
+    irAndDepthListener = listener;
+}
+
+
+void ofProtonectFrameFileReader::setColorAutoExposure(float /*exposureCompensation*/)
+{
+}
+
+
+void ofProtonectFrameFileReader::setColorSemiAutoExposure(float /*pseudoExposureTimeMs*/)
+{
+}
+
+
+void ofProtonectFrameFileReader::setColorManualExposure(float /*integrationTimeMs*/, float /*analogGain*/)
+{
+}
+
+
+void ofProtonectFrameFileReader::setColorSetting(libfreenect2::ColorSettingCommandType /*cmd*/, uint32_t /*value*/)
+{
+}
+
+
+void ofProtonectFrameFileReader::setColorSetting(libfreenect2::ColorSettingCommandType /*cmd*/, float /*value*/)
+{
+}
+
+
+uint32_t ofProtonectFrameFileReader::getColorSetting(libfreenect2::ColorSettingCommandType /*cmd*/)
+{
+    return 0;
+}
+
+
+float ofProtonectFrameFileReader::getColorSettingFloat(libfreenect2::ColorSettingCommandType /*cmd*/)
+{
+    return 0;
+}
+
+
+bool ofProtonectFrameFileReader::start()
+{
+    return startStreams(true, true);
+}
+
+
+bool ofProtonectFrameFileReader::startStreams(bool rgb, bool depth)
+{
+    stop();
+
+    if (!mapping || numFrames == 0)
+    {
+        return false;
+    }
+
+    enableRGB = rgb && (header.streams & ofProtonectFrameFile::REGISTERED);
+    enableDepth = depth && (header.streams & (ofProtonectFrameFile::DEPTH | ofProtonectFrameFile::IR));
+
+    seeked = true;
+    startThread();
+    return true;
+}
+
+
+bool ofProtonectFrameFileReader::stop()
+{
+    if (isThreadRunning())
+    {
+        waitForThread(true);
+    }
+
+    return true;
+}
+
+
+bool ofProtonectFrameFileReader::close()
+{
+    return stop();
+}
+
+
+void ofProtonectFrameFileReader::threadedFunction()
+{
+    auto startTime = std::chrono::steady_clock::now();
+    uint32_t startTimestamp = 0;
+
+    while (isThreadRunning())
+    {
+        std::size_t frame = currentFrame;
+
+        if (paused || frame >= numFrames)
+        {
+            ofSleepMillis(10);
+            continue;
+        }
+
+        if (seeked.exchange(false))
+        {
+            startTime = std::chrono::steady_clock::now();
+            startTimestamp = index[frame].timestamp;
+        }
+        else if (realtime)
+        {
+            // Timestamps are in units of 0.125 ms.
+            uint32_t elapsed = index[frame].timestamp - startTimestamp;
+            std::this_thread::sleep_until(startTime + std::chrono::microseconds(uint64_t(elapsed) * 125));
+        }
+
+        prefetch(frame + 1);
+
+        // Deliver like a device: the listener either keeps a frame or we drop it.
+        if (enableRGB && colorListener)
+        {
+            libfreenect2::Frame* color = createFrame(frame, ofProtonectFrameFile::REGISTERED);
+            if (!colorListener->onNewFrame(libfreenect2::Frame::Color, color)) delete color;
+        }
+
+        if (enableDepth && irAndDepthListener)
+        {
+            libfreenect2::Frame* ir = createFrame(frame, ofProtonectFrameFile::IR);
+            if (!irAndDepthListener->onNewFrame(libfreenect2::Frame::Ir, ir)) delete ir;
+
+            libfreenect2::Frame* depth = createFrame(frame, ofProtonectFrameFile::DEPTH);
+            if (!irAndDepthListener->onNewFrame(libfreenect2::Frame::Depth, depth)) delete depth;
+        }
+
+        // Don't step over a seek that happened meanwhile.
+        std::size_t next = frame + 1;
+
+        if (next >= numFrames && loop)
+        {
+            next = 0;
+            seeked = true;
+        }
+
+        currentFrame.compare_exchange_strong(frame, next);
+    }
+}
@@ -0,0 +1,156 @@
+//  ofProtonectFrameFileReader.h
+//
+//  Plays back a file of decoded frames straight from a memory mapping.
+
+
+#pragma once
+
+
+#include "ofMain.h"
+
+#include <libfreenect2/libfreenect2.hpp>
+
+#include "ofProtonectFrameFile.h"
+
+
+/// \brief Reads a file written by ofProtonectFrameFileWriter.
+///
+/// The file is memory mapped, so frames are paged in as they are touched and
+/// even long recordings don't have to fit in memory. Every frame can be
+/// reached in constant time and is accessed in place.
+///
+/// It also is a libfreenect2 device: once started it plays the file to the
+/// frame listeners from its own thread. The frames it delivers are views into
+/// the mapping that keep it alive, so nothing gets copied. Recorded registered
+/// color is delivered as a 512x424 color frame, open the file with
+/// ofProtonect::openFrameFile() so it isn't registered a second time.
+class ofProtonectFrameFileReader: public libfreenect2::Freenect2Device, public ofThread
+{
+public:
+    ofProtonectFrameFileReader();
+    virtual ~ofProtonectFrameFileReader();
+
+    /// \brief Map a file.
+    /// \returns true if the file is a valid frame file.
+    bool load(const std::string& path);
+
+    bool isLoaded() const;
+
+    /// \returns the bitwise or of the ofProtonectFrameFile::Stream in the file.
+    uint32_t getStreams() const;
+
+    std::size_t getNumFrames() const;
+
+    uint32_t getTimestamp(std::size_t frame) const;
+    uint32_t getSequence(std::size_t frame) const;
+
+    /// \returns the first frame at or after a timestamp.
+    std::size_t findFrameByTimestamp(uint32_t timestamp) const;
+
+    /// \returns the frame with a sequence number, getNumFrames() if there is none.
+    std::size_t findFrameBySequence(uint32_t sequence) const;
+
+    /// \returns the depth of a frame, nullptr if it wasn't recorded.
+    const float* getDepth(std::size_t frame) const;
+
+    /// \returns the IR of a frame, nullptr if it wasn't recorded.
+    const float* getIr(std::size_t frame) const;
+
+    /// \returns the BGRX registered color of a frame, nullptr if it wasn't recorded.
+    const unsigned char* getRegistered(std::size_t frame) const;
+
+    /// \returns the organized XYZ point cloud of a frame, nullptr if it wasn't recorded.
+    const float* getPointCloud(std::size_t frame) const;
+
+    /// \brief Continue playback at a frame.
+    void seek(std::size_t frame);
+
+    /// \returns the frame that is played next.
+    std::size_t getCurrentFrame() const;
+
+    /// \brief Keep the recorded frame rate, otherwise play as fast as the
+    /// listeners take the frames.
+    void setRealtime(bool realtime);
+
+    /// \brief Start over at the end of the file.
+    void setLoop(bool loop);
+
+    void setPaused(bool paused);
+    bool isPaused() const;
+
+    std::string getSerialNumber() override;
+    std::string getFirmwareVersion() override;
+
+    ColorCameraParams getColorCameraParams() override;
+    IrCameraParams getIrCameraParams() override;
+    void setColorCameraParams(const ColorCameraParams& params) override;
+    void setIrCameraParams(const IrCameraParams& params) override;
+    void setConfiguration(const Config& config) override;
+
+    void setColorFrameListener(libfreenect2::FrameListener* listener) override;
+    void setIrAndDepthFrameListener(libfreenect2::FrameListener* listener) override;
+
+    void setColorAutoExposure(float exposureCompensation = 0) override;
+    void setColorSemiAutoExposure(float pseudoExposureTimeMs) override;
+    void setColorManualExposure(float integrationTimeMs, float analogGain) override;
+    void setColorSetting(libfreenect2::ColorSettingCommandType cmd, uint32_t value) override;
+    void setColorSetting(libfreenect2::ColorSettingCommandType cmd, float value) override;
+    uint32_t getColorSetting(libfreenect2::ColorSettingCommandType cmd) override;
+    float getColorSettingFloat(libfreenect2::ColorSettingCommandType cmd) override;
+
+    bool start() override;
+    bool startStreams(bool rgb, bool depth) override;
+    bool stop() override;
+    bool close() override;
+
+protected:
+    void threadedFunction() override;
+
+    /// \brief A read only mapping of a whole file.
+    struct Mapping
+    {
+        ~Mapping();
+
+        const unsigned char* data = nullptr;
+        uint64_t size = 0;
+
+        // Stands in for streams that weren't recorded.
+        std::vector<unsigned char> zeros;
+
+#ifdef TARGET_WIN32
+        void* file = nullptr;
+        void* mapping = nullptr;
+#endif
+    };
+
+    /// \returns the start of a stream block, nullptr if it wasn't recorded.
+    const unsigned char* getStream(std::size_t frame, ofProtonectFrameFile::Stream stream) const;
+
+    /// \returns a frame that views a stream block and keeps the mapping alive.
+    libfreenect2::Frame* createFrame(std::size_t frame, ofProtonectFrameFile::Stream stream) const;
+
+    /// \brief Ask the OS to read a frame ahead of time.
+    void prefetch(std::size_t frame) const;
+
+    std::string path;
+
+    std::shared_ptr<Mapping> mapping;
+    ofProtonectFrameFile::FileHeader header;
+
+    const ofProtonectFrameFile::IndexEntry* index = nullptr;
+    // The index of files that were never closed, recovered from the frames.
+    std::vector<ofProtonectFrameFile::IndexEntry> recoveredIndex;
+    std::size_t numFrames = 0;
+
+    std::atomic<std::size_t> currentFrame;
+    std::atomic<bool> seeked;
+    std::atomic<bool> realtime;
+    std::atomic<bool> loop;
+    std::atomic<bool> paused;
+
+    libfreenect2::FrameListener* colorListener = nullptr;
+    libfreenect2::FrameListener* irAndDepthListener = nullptr;
+
+    bool enableRGB = false;
+    bool enableDepth = false;
+};
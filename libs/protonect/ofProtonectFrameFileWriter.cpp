@@ -0,0 +1,288 @@
+//  ofProtonectFrameFileWriter.cpp
+
+
+#include "ofProtonectFrameFileWriter.h"
+
+
+#include <algorithm>
+
+
+namespace
+{
+    // Large enough to hand whole stream blocks to the OS at once.
+    const std::size_t WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+}
+
+
+ofProtonectFrameFileWriter::ofProtonectFrameFileWriter(std::size_t _maxQueueSize):
+    failed(false),
+    maxQueueSize(std::max<std::size_t>(_maxQueueSize, 1))
+{
+    std::memset(&header, 0, sizeof(header));
+}
+
+
+ofProtonectFrameFileWriter::~ofProtonectFrameFileWriter()
+{
+    close();
+}
+
+
+bool ofProtonectFrameFileWriter::open(const std::string& path,
+                                      uint32_t streams,
+                                      const libfreenect2::Freenect2Device::IrCameraParams& irParams,
+                                      const libfreenect2::Freenect2Device::ColorCameraParams& colorParams)
+{
+    close();
+
+    file = std::fopen(path.c_str(), "wb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    std::setvbuf(file, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+
+    std::memset(&header, 0, sizeof(header));
+    ofProtonectFrameFile::setMagic(header);
+    header.version = ofProtonectFrameFile::VERSION;
+    header.streams = streams;
+    header.width = ofProtonectFrameFile::WIDTH;
+    header.height = ofProtonectFrameFile::HEIGHT;
+    header.frameStride = ofProtonectFrameFile::getFrameStride(streams);
+    header.dataOffset = ofProtonectFrameFile::alignToPage(sizeof(header));
+    header.irParams = irParams;
+    header.colorParams = colorParams;
+
+    index.clear();
+    failed = false;
+    closing = false;
+
+    // The frame stride may differ, and the padding of reused buffers must be zero.
+    freeBuffers.clear();
+
+    std::vector<unsigned char> zeros(header.dataOffset - sizeof(header), 0);
+
+    writeBlock(&header, sizeof(header));
+    writeBlock(zeros.data(), zeros.size());
+
+    if (failed)
+    {
+        return false;
+    }
+
+    writer = std::thread(&ofProtonectFrameFileWriter::writeFrames, this);
+
+    return true;
+}
+
+
+bool ofProtonectFrameFileWriter::write(uint32_t timestamp,
+                                       uint32_t sequence,
+                                       const float* depth,
+                                       const float* ir,
+                                       const unsigned char* registered,
+                                       const float* pointCloud)
+{
+    if (!file || failed)
+    {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+
+    queueCondition.wait(lock, [this]()
+    {
+        return queue.size() < maxQueueSize || failed;
+    });
+
+    if (failed)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> buffer;
+
+    if (!freeBuffers.empty())
+    {
+        buffer = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+    }
+
+    // Copied outside the lock, so the writer can go on meanwhile.
+    lock.unlock();
+
+    // New buffers start out as zeros, so the padding at the end is.
+    buffer.resize(header.frameStride);
+
+    ofProtonectFrameFile::FrameHeader frameHeader;
+    std::memset(&frameHeader, 0, sizeof(frameHeader));
+    frameHeader.timestamp = timestamp;
+    frameHeader.sequence = sequence;
+    frameHeader.streams = header.streams;
+
+    std::memcpy(buffer.data(), &frameHeader, sizeof(frameHeader));
+
+    std::size_t offset = sizeof(frameHeader);
+
+    const void* blocks[] = { depth, ir, registered, pointCloud };
+    const ofProtonectFrameFile::Stream streams[] =
+    {
+        ofProtonectFrameFile::DEPTH,
+        ofProtonectFrameFile::IR,
+        ofProtonectFrameFile::REGISTERED,
+        ofProtonectFrameFile::POINT_CLOUD
+    };
+
+    for (std::size_t i = 0; i < 4; i++)
+    {
+        if (header.streams & streams[i])
+        {
+            std::size_t streamSize = ofProtonectFrameFile::getStreamSize(streams[i]);
+
+            if (blocks[i])
+            {
+                std::memcpy(buffer.data() + offset, blocks[i], streamSize);
+            }
+            else
+            {
+                std::memset(buffer.data() + offset, 0, streamSize);
+            }
+
+            offset += streamSize;
+        }
+    }
+
+    lock.lock();
+    queue.emplace_back(ofProtonectFrameFile::IndexEntry{ timestamp, sequence }, std::move(buffer));
+    lock.unlock();
+
+    queueCondition.notify_all();
+
+    return true;
+}
+
+
+bool ofProtonectFrameFileWriter::close()
+{
+    if (!file)
+    {
+        return false;
+    }
+
+    if (writer.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            closing = true;
+        }
+
+        queueCondition.notify_all();
+
+        // The writer drains the queue before it returns.
+        writer.join();
+    }
+
+    if (!failed)
+    {
+        header.numFrames = index.size();
+        header.indexOffset = header.dataOffset + header.numFrames * header.frameStride;
+
+        writeBlock(index.data(), index.size() * sizeof(ofProtonectFrameFile::IndexEntry));
+
+        // Only a complete index gets announced in the header.
+        if (!failed && std::fseek(file, 0, SEEK_SET) == 0)
+        {
+            writeBlock(&header, sizeof(header));
+        }
+    }
+
+    if (std::fclose(file) != 0)
+    {
+        failed = true;
+    }
+
+    file = nullptr;
+    index.clear();
+
+    return !failed;
+}
+
+
+bool ofProtonectFrameFileWriter::isOpen() const
+{
+    return file != nullptr;
+}
+
+
+uint32_t ofProtonectFrameFileWriter::getStreams() const
+{
+    return header.streams;
+}
+
+
+uint64_t ofProtonectFrameFileWriter::getNumFrames() const
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    return index.size();
+}
+
+
+std::size_t ofProtonectFrameFileWriter::getNumQueuedFrames() const
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    return queue.size();
+}
+
+
+void ofProtonectFrameFileWriter::writeFrames()
+{
+    while (true)
+    {
+        std::pair<ofProtonectFrameFile::IndexEntry, std::vector<unsigned char>> frame;
+
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+
+            queueCondition.wait(lock, [this]()
+            {
+                return !queue.empty() || closing;
+            });
+
+            if (queue.empty())
+            {
+                break;
+            }
+
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        // There's room in the queue again, or write() has to learn it failed.
+        queueCondition.notify_all();
+
+        // Frames queued after a failure are dropped.
+        const bool written = writeBlock(frame.second.data(), frame.second.size());
+
+        std::unique_lock<std::mutex> lock(queueMutex);
+
+        if (written)
+        {
+            index.push_back(frame.first);
+        }
+
+        freeBuffers.push_back(std::move(frame.second));
+    }
+}
+
+
+bool ofProtonectFrameFileWriter::writeBlock(const void* data, std::size_t size)
+{
+    if (!failed && size > 0 && std::fwrite(data, 1, size, file) != size)
+    {
+        failed = true;
+    }
+
+    return !failed;
+}
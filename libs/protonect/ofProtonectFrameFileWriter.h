@@ -0,0 +1,98 @@
+//  ofProtonectFrameFileWriter.h
+//
+//  Writes decoded frames into a single indexed file.
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ofProtonectFrameFile.h"
+
+
+/// \brief Writes frames in the ofProtonectFrameFile layout.
+///
+/// Frames are copied into a bounded queue and written by a thread of their
+/// own, one write per frame. When the disk can't keep up write() waits for
+/// room in the queue, so frames are never lost, e.g. when converting a
+/// replay. The index is written when the file is closed.
+class ofProtonectFrameFileWriter
+{
+public:
+    /// \param maxQueueSize The number of frames that may wait to be written.
+    ofProtonectFrameFileWriter(std::size_t maxQueueSize = 8);
+    ~ofProtonectFrameFileWriter();
+
+    /// \brief Create a file, replacing an existing one.
+    /// \param path The path of the file.
+    /// \param streams Bitwise or of the ofProtonectFrameFile::Stream to record.
+    /// \param irParams The depth camera parameters of the recorded device.
+    /// \param colorParams The color camera parameters of the recorded device.
+    /// \returns true if the file was created.
+    bool open(const std::string& path,
+              uint32_t streams,
+              const libfreenect2::Freenect2Device::IrCameraParams& irParams,
+              const libfreenect2::Freenect2Device::ColorCameraParams& colorParams);
+
+    /// \brief Append a frame.
+    ///
+    /// Streams that were not recorded are ignored, recorded streams passed as
+    /// nullptr are written as zeros. The data is copied, the frame is written
+    /// later.
+    /// \returns false if writing failed, this or an earlier frame.
+    bool write(uint32_t timestamp,
+               uint32_t sequence,
+               const float* depth,
+               const float* ir,
+               const unsigned char* registered,
+               const float* pointCloud);
+
+    /// \brief Write the queued frames and the index, and close the file.
+    /// \returns true if everything was written.
+    bool close();
+
+    bool isOpen() const;
+
+    uint32_t getStreams() const;
+
+    /// \returns the number of frames written so far.
+    uint64_t getNumFrames() const;
+
+    /// \returns the number of frames waiting to be written.
+    std::size_t getNumQueuedFrames() const;
+
+private:
+    /// \brief Write the queued frames until close().
+    void writeFrames();
+
+    bool writeBlock(const void* data, std::size_t size);
+
+    std::FILE* file = nullptr;
+    std::atomic<bool> failed;
+
+    ofProtonectFrameFile::FileHeader header;
+    std::vector<ofProtonectFrameFile::IndexEntry> index;
+
+    std::size_t maxQueueSize;
+    std::thread writer;
+    bool closing = false;
+
+    mutable std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    // Whole frames laid out like in the file, with their index entries.
+    std::deque<std::pair<ofProtonectFrameFile::IndexEntry, std::vector<unsigned char>>> queue;
+
+    // Buffers of written frames, reused so recording doesn't allocate.
+    std::vector<std::vector<unsigned char>> freeBuffers;
+
+    ofProtonectFrameFileWriter(const ofProtonectFrameFileWriter&) = delete;
+    ofProtonectFrameFileWriter& operator=(const ofProtonectFrameFileWriter&) = delete;
+};
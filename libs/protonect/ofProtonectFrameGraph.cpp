@@ -0,0 +1,170 @@
+//  ofProtonectFrameGraph.cpp
+
+
+#include "ofProtonectFrameGraph.h"
+
+
+#include "ofMain.h"
+
+#include "ofProtonectTimings.h"
+
+
+std::size_t ofProtonectFrameGraph::addNode(const std::string& name, std::function<void()> process, std::function<void()> skip)
+{
+    if (nodes.size() == MAX_NODES)
+    {
+        ofLogError("ofProtonectFrameGraph::addNode") << "Too many nodes, " << name << " is not added.";
+        return MAX_NODES;
+    }
+
+    Node node;
+    node.name = name;
+    node.process = std::move(process);
+    node.skip = std::move(skip);
+
+    nodes.push_back(std::move(node));
+    return nodes.size() - 1;
+}
+
+
+void ofProtonectFrameGraph::setInputs(std::size_t node, NodeSet inputs)
+{
+    nodes[node].inputs = inputs;
+}
+
+
+ofProtonectFrameGraph::NodeSet ofProtonectFrameGraph::getInputs(std::size_t node) const
+{
+    return nodes[node].inputs;
+}
+
+
+bool ofProtonectFrameGraph::schedule(NodeSet outputs)
+{
+    // Grow the set by the inputs of its nodes until nothing gets added.
+    NodeSet reachable = outputs;
+    NodeSet previous;
+
+    do
+    {
+        previous = reachable;
+
+        for (std::size_t i = 0; i < nodes.size(); i++)
+        {
+            if (reachable & toSet(i))
+            {
+                reachable |= nodes[i].inputs;
+            }
+        }
+    }
+    while (reachable != previous);
+
+    // Peel off the nodes whose inputs are done, wave by wave.
+    waves.clear();
+    NodeSet done = 0;
+
+    while (done != reachable)
+    {
+        NodeSet wave = 0;
+
+        for (std::size_t i = 0; i < nodes.size(); i++)
+        {
+            if ((reachable & ~done & toSet(i)) && (nodes[i].inputs & ~done) == 0)
+            {
+                wave |= toSet(i);
+            }
+        }
+
+        if (wave == 0)
+        {
+            ofLogError("ofProtonectFrameGraph::schedule") << "The node inputs form a cycle.";
+            waves.clear();
+            scheduled = 0;
+            return false;
+        }
+
+        waves.push_back(wave);
+        done |= wave;
+    }
+
+    scheduled = reachable;
+    return true;
+}
+
+
+ofProtonectFrameGraph::NodeSet ofProtonectFrameGraph::getScheduled() const
+{
+    return scheduled;
+}
+
+
+bool ofProtonectFrameGraph::isScheduled(std::size_t node) const
+{
+    return (scheduled & toSet(node)) != 0;
+}
+
+
+void ofProtonectFrameGraph::run(ofProtonectWorkerPool* pool)
+{
+    for (std::size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].duration = 0;
+
+        if (!isScheduled(i) && nodes[i].skip)
+        {
+            nodes[i].skip();
+        }
+    }
+
+    for (NodeSet wave: waves)
+    {
+        waveNodes.clear();
+
+        for (std::size_t i = 0; i < nodes.size(); i++)
+        {
+            if (wave & toSet(i))
+            {
+                waveNodes.push_back(i);
+            }
+        }
+
+        // The nodes may use the pool themselves, the pool lets them.
+        auto process = [this](std::size_t i) {
+            Node& node = nodes[waveNodes[i]];
+            const uint64_t startTime = ofProtonectTimings::now();
+
+            node.process();
+            node.duration = ofProtonectTimings::now() - startTime;
+        };
+
+        if (pool)
+        {
+            pool->parallelFor(waveNodes.size(), process);
+        }
+        else
+        {
+            for (std::size_t i = 0; i < waveNodes.size(); i++)
+            {
+                process(i);
+            }
+        }
+    }
+}
+
+
+uint64_t ofProtonectFrameGraph::getDuration(std::size_t node) const
+{
+    return nodes[node].duration;
+}
+
+
+std::size_t ofProtonectFrameGraph::getNumNodes() const
+{
+    return nodes.size();
+}
+
+
+const std::string& ofProtonectFrameGraph::getName(std::size_t node) const
+{
+    return nodes[node].name;
+}
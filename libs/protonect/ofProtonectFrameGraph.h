@@ -0,0 +1,87 @@
+//  ofProtonectFrameGraph.h
+//
+//  Schedules the processing of a frame as a graph of dependent steps.
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ofProtonectWorkerPool.h"
+
+
+/// \brief A small dataflow graph that is run once per frame.
+///
+/// Each node is a processing step that declares which nodes it reads the
+/// outputs of. Scheduling a set of outputs picks the nodes they depend on,
+/// directly or not, and nothing else. Running the graph then processes the
+/// scheduled nodes in waves: a wave holds every node whose inputs all ran in
+/// earlier waves, and the nodes of a wave run concurrently.
+///
+/// Nodes communicate through buffers they own or share with the caller, the
+/// graph only decides when each one runs. Inputs can change between frames,
+/// e.g. when a setting makes a step need another one.
+class ofProtonectFrameGraph
+{
+public:
+    /// \brief A set of nodes, bit n stands for the node with id n.
+    typedef uint32_t NodeSet;
+
+    static const std::size_t MAX_NODES = 32;
+
+    /// \returns the set holding just one node.
+    static NodeSet toSet(std::size_t node)
+    {
+        return NodeSet(1) << node;
+    }
+
+    /// \brief Add a node without inputs.
+    /// \param name The name of the node for log messages.
+    /// \param process Computes the outputs of the node from its inputs.
+    /// \param skip Called instead of process when the node isn't scheduled,
+    ///        e.g. to clear stale outputs. May be empty.
+    /// \returns the id of the node, ids count up from 0.
+    std::size_t addNode(const std::string& name, std::function<void()> process, std::function<void()> skip = nullptr);
+
+    /// \brief Set the nodes a node reads the outputs of.
+    void setInputs(std::size_t node, NodeSet inputs);
+    NodeSet getInputs(std::size_t node) const;
+
+    /// \brief Schedule the given nodes and everything they depend on.
+    /// \returns false if the inputs form a cycle, nothing is scheduled then.
+    bool schedule(NodeSet outputs);
+
+    NodeSet getScheduled() const;
+    bool isScheduled(std::size_t node) const;
+
+    /// \brief Run the scheduled nodes and skip all others.
+    /// \param pool Runs the nodes of a wave concurrently, nullptr runs them
+    ///        one after the other on the calling thread.
+    void run(ofProtonectWorkerPool* pool);
+
+    /// \returns how long a node took in the last run in nanoseconds, 0 if it was skipped.
+    uint64_t getDuration(std::size_t node) const;
+
+    std::size_t getNumNodes() const;
+    const std::string& getName(std::size_t node) const;
+
+protected:
+    struct Node
+    {
+        std::string name;
+        std::function<void()> process;
+        std::function<void()> skip;
+        NodeSet inputs = 0;
+        uint64_t duration = 0;
+    };
+
+    std::vector<Node> nodes;
+    NodeSet scheduled = 0;
+    // The scheduled nodes, in the order they can run in.
+    std::vector<NodeSet> waves;
+    std::vector<std::size_t> waveNodes;
+};
@@ -0,0 +1,225 @@
+//  ofProtonectFrameListener.cpp
+
+
+#include "ofProtonectFrameListener.h"
+
+
+#include <chrono>
+
+
+ofProtonectFrameListener::ofProtonectFrameListener(unsigned int frameTypes, std::size_t poolSize):
+    state(std::make_shared<State>())
+{
+    state->frameTypes = frameTypes;
+    state->poolSize = poolSize;
+}
+
+
+ofProtonectFrameListener::~ofProtonectFrameListener()
+{
+}
+
+
+bool ofProtonectFrameListener::waitForNewFrame(FrameMap& frames, int milliseconds)
+{
+    FrameMap received;
+
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+
+        if (!state->condition.wait_for(lock,
+                                       std::chrono::milliseconds(milliseconds),
+                                       [this]() { return state->cancelled || state->isComplete(); })
+            || state->cancelled)
+        {
+            return false;
+        }
+
+        std::shared_ptr<State> owner = state;
+
+        for (auto& entry: state->pending)
+        {
+            libfreenect2::Frame::Type type = entry.first;
+
+            received[type] = std::shared_ptr<libfreenect2::Frame>(entry.second, [owner, type](libfreenect2::Frame* frame)
+            {
+                delete frame;
+
+                {
+                    std::unique_lock<std::mutex> lock(owner->mutex);
+                    owner->numAlive[type]--;
+                }
+
+                owner->condition.notify_all();
+            });
+        }
+
+        state->pending.clear();
+    }
+
+    state->condition.notify_all();
+
+    // The frames previously held by the caller are released outside the lock,
+    // their deleters need it.
+    frames.swap(received);
+
+    return true;
+}
+
+
+bool ofProtonectFrameListener::hasNewFrame() const
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    return state->isComplete();
+}
+
+
+void ofProtonectFrameListener::setBlocking(bool blocking)
+{
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->blocking = blocking && !state->cancelled;
+    }
+
+    state->condition.notify_all();
+}
+
+
+void ofProtonectFrameListener::setFrameTypes(unsigned int frameTypes)
+{
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->frameTypes = frameTypes;
+
+        for (auto iter = state->pending.begin(); iter != state->pending.end();)
+        {
+            if ((iter->first & frameTypes) == 0)
+            {
+                delete iter->second;
+                state->numAlive[iter->first]--;
+                iter = state->pending.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    state->condition.notify_all();
+}
+
+
+void ofProtonectFrameListener::cancel()
+{
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cancelled = true;
+        state->blocking = false;
+    }
+
+    state->condition.notify_all();
+}
+
+
+bool ofProtonectFrameListener::isCancelled() const
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    return state->cancelled;
+}
+
+
+uint64_t ofProtonectFrameListener::getNumDroppedFrames(libfreenect2::Frame::Type type) const
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    auto iter = state->numDropped.find(type);
+    return iter != state->numDropped.end() ? iter->second : 0;
+}
+
+
+uint64_t ofProtonectFrameListener::getNumDroppedFrames() const
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+
+    uint64_t total = 0;
+
+    for (const auto& entry: state->numDropped)
+    {
+        total += entry.second;
+    }
+
+    return total;
+}
+
+
+bool ofProtonectFrameListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame* frame)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+
+    if ((state->frameTypes & type) == 0)
+    {
+        return false;
+    }
+
+    if (state->blocking)
+    {
+        state->condition.wait(lock, [this, type]()
+        {
+            return !state->blocking || (state->frameTypes & type) == 0
+                || (state->pending.count(type) == 0 && state->numAlive[type] < state->poolSize);
+        });
+
+        // The type may have been turned off while waiting.
+        if ((state->frameTypes & type) == 0)
+        {
+            return false;
+        }
+    }
+
+    auto pending = state->pending.find(type);
+
+    if (pending != state->pending.end())
+    {
+        // Nobody picked up the previous frame yet, the new one takes its place.
+        delete pending->second;
+        pending->second = frame;
+        state->numDropped[type]++;
+    }
+    else if (state->numAlive[type] >= state->poolSize)
+    {
+        state->numDropped[type]++;
+        return false;
+    }
+    else
+    {
+        state->pending[type] = frame;
+        state->numAlive[type]++;
+    }
+
+    lock.unlock();
+    state->condition.notify_all();
+
+    return true;
+}
+
+
+ofProtonectFrameListener::State::~State()
+{
+    for (auto& entry: pending)
+    {
+        delete entry.second;
+    }
+}
+
+
+bool ofProtonectFrameListener::State::isComplete() const
+{
+    unsigned int types = 0;
+
+    for (const auto& entry: pending)
+    {
+        types |= entry.first;
+    }
+
+    return (types & frameTypes) == frameTypes;
+}
@@ -0,0 +1,103 @@
+//  ofProtonectFrameListener.h
+//
+//  Hands decoded libfreenect2 frames to consumers without copying them.
+
+
+#pragma once
+
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <libfreenect2/frame_listener.hpp>
+
+
+/// \brief A frame listener that keeps the frames libfreenect2 decodes.
+///
+/// Unlike libfreenect2::SyncMultiFrameListener the frames are handed out as
+/// shared pointers, so consumers can wrap the decoded memory directly instead
+/// of copying it, and a frame is released when its last user drops it.
+///
+/// libfreenect2 allocates a replacement every time a listener keeps a frame,
+/// so the number of frames of each type that may be alive at once is bounded
+/// by a fixed pool size. Once the pool is exhausted new frames are dropped and
+/// counted instead; libfreenect2 then decodes into the frame it already has
+/// and nothing gets allocated.
+class ofProtonectFrameListener: public libfreenect2::FrameListener
+{
+public:
+    typedef std::map<libfreenect2::Frame::Type, std::shared_ptr<libfreenect2::Frame>> FrameMap;
+
+    /// \param frameTypes Bitwise or of the libfreenect2::Frame::Type to wait for.
+    /// \param poolSize The number of frames of each type that may be alive at once.
+    ofProtonectFrameListener(unsigned int frameTypes, std::size_t poolSize);
+    virtual ~ofProtonectFrameListener();
+
+    /// \brief Wait for a frame of every type this listener was created for.
+    /// \param frames Receives the frames, replacing its previous content.
+    /// \param milliseconds Timeout.
+    /// \returns true if frames were received, false on timeout or once cancelled.
+    bool waitForNewFrame(FrameMap& frames, int milliseconds);
+
+    /// \brief Wake up and fail every current and future waitForNewFrame().
+    ///
+    /// Also stops blocking the producer. Can be called from any thread.
+    void cancel();
+
+    bool isCancelled() const;
+
+    /// \returns true if a frame of every type is waiting.
+    bool hasNewFrame() const;
+
+    /// \brief Make the producer wait instead of dropping frames.
+    ///
+    /// When blocking, onNewFrame() waits until the previous frame of the same
+    /// type was picked up and the pool has room again. Use this for sources
+    /// that can be slowed down, like recordings. Turning it off wakes up a
+    /// waiting producer.
+    void setBlocking(bool blocking);
+
+    /// \brief Change the frame types to wait for while frames arrive.
+    ///
+    /// Frames of other types are ignored from then on, waiting ones are
+    /// released. Can be called from any thread.
+    /// \param frameTypes Bitwise or of the libfreenect2::Frame::Type to wait for.
+    void setFrameTypes(unsigned int frameTypes);
+
+    /// \returns the number of frames of the given type that were dropped.
+    uint64_t getNumDroppedFrames(libfreenect2::Frame::Type type) const;
+
+    /// \returns the number of frames of all types that were dropped.
+    uint64_t getNumDroppedFrames() const;
+
+    bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame* frame) override;
+
+private:
+    struct State
+    {
+        ~State();
+
+        bool isComplete() const;
+
+        unsigned int frameTypes;
+        std::size_t poolSize;
+        bool blocking = false;
+        bool cancelled = false;
+
+        mutable std::mutex mutex;
+        std::condition_variable condition;
+
+        std::map<libfreenect2::Frame::Type, libfreenect2::Frame*> pending;
+        std::map<libfreenect2::Frame::Type, std::size_t> numAlive;
+        std::map<libfreenect2::Frame::Type, uint64_t> numDropped;
+    };
+
+    // Shared with the deleters of the frames handed out, which may outlive us.
+    std::shared_ptr<State> state;
+
+    ofProtonectFrameListener(const ofProtonectFrameListener&) = delete;
+    ofProtonectFrameListener& operator=(const ofProtonectFrameListener&) = delete;
+};
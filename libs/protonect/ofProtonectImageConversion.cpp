@@ -0,0 +1,114 @@
+//  ofProtonectImageConversion.cpp
+
+
+#include "ofProtonectImageConversion.h"
+
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OF_PROTONECT_IMAGE_CONVERSION_SSE
+#endif
+
+
+namespace
+{
+    /// ofMap(value, inputMin, inputMax, outputMin, outputMax, true) to 8 bit,
+    /// optionally turning white into black.
+    template<bool ZERO_WHITE>
+    void mapToGray(const float* values,
+                   std::size_t numPixels,
+                   float inputMin,
+                   float inputMax,
+                   float outputMin,
+                   float outputMax,
+                   unsigned char* gray)
+    {
+        const float inputRange = inputMax - inputMin;
+        const float outputRange = outputMax - outputMin;
+        const float low = outputMin < outputMax ? outputMin : outputMax;
+        const float high = outputMin < outputMax ? outputMax : outputMin;
+
+        std::size_t i = 0;
+
+#if defined(OF_PROTONECT_IMAGE_CONVERSION_SSE)
+        const __m128 inputMinBatch = _mm_set1_ps(inputMin);
+        const __m128 inputRangeBatch = _mm_set1_ps(inputRange);
+        const __m128 outputMinBatch = _mm_set1_ps(outputMin);
+        const __m128 outputRangeBatch = _mm_set1_ps(outputRange);
+        const __m128 lowBatch = _mm_set1_ps(low);
+        const __m128 highBatch = _mm_set1_ps(high);
+        const __m128i white = _mm_set1_epi32(255);
+
+        // Sixteen pixels fill one register of bytes.
+        for (; i + 16 <= numPixels; i += 16)
+        {
+            __m128i converted[4];
+
+            for (int j = 0; j < 4; j++)
+            {
+                __m128 value = _mm_loadu_ps(values + i + 4 * j);
+                value = _mm_add_ps(_mm_mul_ps(_mm_div_ps(_mm_sub_ps(value, inputMinBatch), inputRangeBatch), outputRangeBatch), outputMinBatch);
+
+                // max returns its second operand for NaN, which makes it low.
+                value = _mm_min_ps(_mm_max_ps(value, lowBatch), highBatch);
+                converted[j] = _mm_cvttps_epi32(value);
+
+                if (ZERO_WHITE)
+                {
+                    converted[j] = _mm_andnot_si128(_mm_cmpeq_epi32(converted[j], white), converted[j]);
+                }
+            }
+
+            const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(converted[0], converted[1]),
+                                                    _mm_packs_epi32(converted[2], converted[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(gray + i), packed);
+        }
+#endif
+
+        for (; i < numPixels; i++)
+        {
+            float value = (values[i] - inputMin) / inputRange * outputRange + outputMin;
+            value = value > low ? value : low;
+            value = value < high ? value : high;
+
+            const int converted = static_cast<int>(value);
+            gray[i] = static_cast<unsigned char>(ZERO_WHITE && converted == 255 ? 0 : converted);
+        }
+    }
+}
+
+
+void ofProtonectImageConversion::convertDepth(const float* depth,
+                                              std::size_t numPixels,
+                                              float minDistance,
+                                              float maxDistance,
+                                              unsigned char* gray)
+{
+    // ofMap() returns the output minimum for an empty range, which is white.
+    if (std::abs(minDistance - maxDistance) < std::numeric_limits<float>::epsilon())
+    {
+        std::memset(gray, 0, numPixels);
+        return;
+    }
+
+    mapToGray<true>(depth, numPixels, minDistance, maxDistance, 255, 0, gray);
+}
+
+
+void ofProtonectImageConversion::convertIr(const float* ir,
+                                           std::size_t numPixels,
+                                           float maxValue,
+                                           unsigned char* gray)
+{
+    if (maxValue <= 0)
+    {
+        std::memset(gray, 0, numPixels);
+        return;
+    }
+
+    mapToGray<false>(ir, numPixels, 0, maxValue, 0, 255, gray);
+}
@@ -0,0 +1,43 @@
+//  ofProtonectImageConversion.h
+//
+//  Converts float depth and IR images to 8 bit for display.
+
+
+#pragma once
+
+
+#include <cstddef>
+
+
+/// \brief Maps float depth and IR to 8 bit grayscale.
+///
+/// The results are the same as mapping every pixel with ofMap() and
+/// clamping, but batches of pixels are processed with SSE2 where available,
+/// scalar elsewhere.
+class ofProtonectImageConversion
+{
+public:
+    /// \brief Map depth to gray, near is bright and far is dark.
+    ///
+    /// Depth outside [minDistance, maxDistance) and invalid depth become 0.
+    /// \param depth The depth in millimeters.
+    /// \param numPixels The number of pixels.
+    /// \param minDistance The depth mapped to white in millimeters.
+    /// \param maxDistance The depth mapped to black in millimeters.
+    /// \param gray Receives numPixels values.
+    static void convertDepth(const float* depth,
+                             std::size_t numPixels,
+                             float minDistance,
+                             float maxDistance,
+                             unsigned char* gray);
+
+    /// \brief Map IR to gray, from 0 at 0 to 255 at maxValue.
+    /// \param ir The IR values.
+    /// \param numPixels The number of pixels.
+    /// \param maxValue The IR value mapped to white.
+    /// \param gray Receives numPixels values.
+    static void convertIr(const float* ir,
+                          std::size_t numPixels,
+                          float maxValue,
+                          unsigned char* gray);
+};
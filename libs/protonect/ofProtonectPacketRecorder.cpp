@@ -0,0 +1,370 @@
+//  ofProtonectPacketRecorder.cpp
+
+
+#include "ofProtonectPacketRecorder.h"
+
+
+#include <cstring>
+#include <fstream>
+
+
+namespace
+{
+    const char PARAMS_MAGIC[8] = { 'O', 'F', 'K', 'V', '2', 'P', 'R', 'M' };
+    const uint32_t PARAMS_VERSION = 1;
+
+    template<typename T>
+    void writeTable(std::ofstream& file, const std::vector<T>& table)
+    {
+        uint64_t size = table.size();
+        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        file.write(reinterpret_cast<const char*>(table.data()), size * sizeof(T));
+    }
+
+    template<typename T>
+    bool readTable(std::ifstream& file, std::vector<T>& table)
+    {
+        uint64_t size = 0;
+
+        // The tables of a Kinect v2 are well below a million entries.
+        if (!file.read(reinterpret_cast<char*>(&size), sizeof(size)) || size > 1024 * 1024)
+        {
+            return false;
+        }
+
+        table.resize(size);
+        return bool(file.read(reinterpret_cast<char*>(table.data()), size * sizeof(T)));
+    }
+
+    template<typename T>
+    std::vector<T> copyTable(const T* table, std::size_t length)
+    {
+        return table ? std::vector<T>(table, table + length) : std::vector<T>();
+    }
+}
+
+
+ofProtonectPacketRecorder::ofProtonectPacketRecorder(std::size_t _maxQueueSize):
+    maxQueueSize(std::max<std::size_t>(_maxQueueSize, 1)),
+    numWrittenPackets(0),
+    numWrittenBytes(0),
+    numDroppedColor(0),
+    numDroppedDepth(0),
+    numFailedWrites(0)
+{
+}
+
+
+ofProtonectPacketRecorder::~ofProtonectPacketRecorder()
+{
+    close();
+}
+
+
+bool ofProtonectPacketRecorder::open(const std::string& _serial,
+                                     const std::string& _directory,
+                                     const std::string& _prefix,
+                                     bool recordColor,
+                                     bool recordDepth)
+{
+    close();
+
+    serial = _serial.empty() ? freenect2.getDefaultDeviceSerialNumber() : _serial;
+    directory = _directory;
+    prefix = _prefix.empty() ? serial : _prefix;
+
+    if (serial.empty())
+    {
+        ofLogError("ofProtonectPacketRecorder::open") << "no device connected";
+        return false;
+    }
+
+    if (!ofDirectory::doesDirectoryExist(directory, false) && !ofDirectory::createDirectory(directory, false, true))
+    {
+        ofLogError("ofProtonectPacketRecorder::open") << "can't create " << directory;
+        return false;
+    }
+
+    // The device owns and deletes the pipeline.
+    pipeline = new libfreenect2::DumpPacketPipeline();
+    dev = freenect2.openDevice(serial, pipeline);
+
+    if (!dev)
+    {
+        ofLogError("ofProtonectPacketRecorder::open") << "failure opening device with serial " << serial;
+        pipeline = nullptr;
+        return false;
+    }
+
+    numWrittenPackets = 0;
+    numWrittenBytes = 0;
+    numDroppedColor = 0;
+    numDroppedDepth = 0;
+    numFailedWrites = 0;
+
+    startThread();
+
+    dev->setColorFrameListener(this);
+    dev->setIrAndDepthFrameListener(this);
+
+    if (!dev->startStreams(recordColor, recordDepth))
+    {
+        ofLogError("ofProtonectPacketRecorder::open") << "failure starting device with serial " << serial;
+        close();
+        return false;
+    }
+
+    // The device reads its parameters and tables when it starts.
+    DeviceParams params;
+    params.irParams = dev->getIrCameraParams();
+    params.colorParams = dev->getColorCameraParams();
+
+    std::size_t length = 0;
+    const unsigned char* p0Tables = pipeline->getDepthP0Tables(&length);
+    params.p0Tables = copyTable(p0Tables, length);
+    const float* xTable = pipeline->getDepthXTable(&length);
+    params.xTable = copyTable(xTable, length);
+    const float* zTable = pipeline->getDepthZTable(&length);
+    params.zTable = copyTable(zTable, length);
+    const short* lookupTable = pipeline->getDepthLookupTable(&length);
+    params.lookupTable = copyTable(lookupTable, length);
+
+    if (!saveDeviceParams(getParamsPath(), params))
+    {
+        ofLogError("ofProtonectPacketRecorder::open") << "can't write " << getParamsPath();
+    }
+
+    return true;
+}
+
+
+void ofProtonectPacketRecorder::close()
+{
+    if (dev)
+    {
+        dev->stop();
+        dev->close();
+        delete dev;
+        dev = nullptr;
+        pipeline = nullptr;
+    }
+
+    if (isThreadRunning())
+    {
+        {
+            // Holding the lock makes sure the writer can't miss the wake up.
+            std::unique_lock<std::mutex> lock(queueMutex);
+            stopThread();
+        }
+
+        queueCondition.notify_all();
+
+        // The writer drains the queue before it returns.
+        waitForThread(false);
+    }
+}
+
+
+bool ofProtonectPacketRecorder::isRecording() const
+{
+    return dev != nullptr;
+}
+
+
+std::string ofProtonectPacketRecorder::getSerial() const
+{
+    return serial;
+}
+
+
+std::string ofProtonectPacketRecorder::getParamsPath() const
+{
+    return ofFilePath::join(directory, prefix + ".params");
+}
+
+
+bool ofProtonectPacketRecorder::saveDeviceParams(const std::string& path, const DeviceParams& params)
+{
+    std::ofstream file(path, std::ios::binary);
+
+    file.write(PARAMS_MAGIC, sizeof(PARAMS_MAGIC));
+    file.write(reinterpret_cast<const char*>(&PARAMS_VERSION), sizeof(PARAMS_VERSION));
+    file.write(reinterpret_cast<const char*>(&params.irParams), sizeof(params.irParams));
+    file.write(reinterpret_cast<const char*>(&params.colorParams), sizeof(params.colorParams));
+    writeTable(file, params.p0Tables);
+    writeTable(file, params.xTable);
+    writeTable(file, params.zTable);
+    writeTable(file, params.lookupTable);
+
+    return file.good();
+}
+
+
+bool ofProtonectPacketRecorder::loadDeviceParams(const std::string& path, DeviceParams& params)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    char magic[sizeof(PARAMS_MAGIC)];
+    uint32_t version = 0;
+
+    if (!file.read(magic, sizeof(magic))
+        || std::memcmp(magic, PARAMS_MAGIC, sizeof(magic)) != 0
+        || !file.read(reinterpret_cast<char*>(&version), sizeof(version))
+        || version != PARAMS_VERSION)
+    {
+        return false;
+    }
+
+    return file.read(reinterpret_cast<char*>(&params.irParams), sizeof(params.irParams))
+        && file.read(reinterpret_cast<char*>(&params.colorParams), sizeof(params.colorParams))
+        && readTable(file, params.p0Tables)
+        && readTable(file, params.xTable)
+        && readTable(file, params.zTable)
+        && readTable(file, params.lookupTable);
+}
+
+
+std::size_t ofProtonectPacketRecorder::getNumQueuedPackets() const
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    return queue.size();
+}
+
+
+uint64_t ofProtonectPacketRecorder::getNumWrittenPackets() const
+{
+    return numWrittenPackets;
+}
+
+
+uint64_t ofProtonectPacketRecorder::getNumWrittenBytes() const
+{
+    return numWrittenBytes;
+}
+
+
+uint64_t ofProtonectPacketRecorder::getNumDroppedPackets(libfreenect2::Frame::Type type) const
+{
+    switch (type)
+    {
+        case libfreenect2::Frame::Color: return numDroppedColor;
+        case libfreenect2::Frame::Depth: return numDroppedDepth;
+        default: return 0;
+    }
+}
+
+
+uint64_t ofProtonectPacketRecorder::getNumDroppedPackets() const
+{
+    return numDroppedColor + numDroppedDepth + numFailedWrites;
+}
+
+
+uint64_t ofProtonectPacketRecorder::getNumFailedWrites() const
+{
+    return numFailedWrites;
+}
+
+
+bool ofProtonectPacketRecorder::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame* frame)
+{
+    // The dump pipeline hands out depth packets as Depth frames, Ir frames
+    // point at the same packet.
+    if (type != libfreenect2::Frame::Color && type != libfreenect2::Frame::Depth)
+    {
+        return false;
+    }
+
+    std::size_t size = frame->width * frame->height * frame->bytes_per_pixel;
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+
+    if (queue.size() >= maxQueueSize)
+    {
+        if (type == libfreenect2::Frame::Color)
+        {
+            numDroppedColor++;
+        }
+        else
+        {
+            numDroppedDepth++;
+        }
+
+        return false;
+    }
+
+    Packet packet;
+    packet.type = type;
+    packet.timestamp = frame->timestamp;
+    packet.sequence = frame->sequence;
+
+    if (!freeBuffers.empty())
+    {
+        packet.data = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+    }
+
+    // The packet memory belongs to libfreenect2 and is reused once we return.
+    packet.data.assign(frame->data, frame->data + size);
+
+    queue.push_back(std::move(packet));
+    lock.unlock();
+
+    queueCondition.notify_one();
+
+    return false;
+}
+
+
+std::string ofProtonectPacketRecorder::getPacketPath(const Packet& packet) const
+{
+    std::stringstream ss;
+    ss << prefix << "_" << packet.timestamp << "_" << packet.sequence
+       << (packet.type == libfreenect2::Frame::Color ? ".jpg" : ".depth");
+
+    return ofFilePath::join(directory, ss.str());
+}
+
+
+void ofProtonectPacketRecorder::threadedFunction()
+{
+    while (true)
+    {
+        Packet packet;
+
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+
+            queueCondition.wait(lock, [this]()
+            {
+                return !queue.empty() || !isThreadRunning();
+            });
+
+            if (queue.empty())
+            {
+                break;
+            }
+
+            packet = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        std::string path = getPacketPath(packet);
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(packet.data.data()), packet.data.size());
+
+        if (file.good())
+        {
+            numWrittenPackets++;
+            numWrittenBytes += packet.data.size();
+        }
+        else
+        {
+            numFailedWrites++;
+            ofLogError("ofProtonectPacketRecorder::threadedFunction") << "failure writing " << path;
+        }
+
+        std::unique_lock<std::mutex> lock(queueMutex);
+        freeBuffers.push_back(std::move(packet.data));
+    }
+}
@@ -0,0 +1,148 @@
+//  ofProtonectPacketRecorder.h
+//
+//  Records the raw packets of a Kinect v2 in the layout libfreenect2 replays.
+
+
+#pragma once
+
+
+#include "ofMain.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/packet_pipeline.h>
+
+
+/// \brief Writes the undecoded depth packets and color JPEGs of a device.
+///
+/// The device is opened with a libfreenect2::DumpPacketPipeline, which hands
+/// out the packets as they come off USB instead of decoding them. They are
+/// written to <directory>/<prefix>_<timestamp>_<sequence>.depth and .jpg, the
+/// names libfreenect2::Freenect2Replay and ofProtonect::openReplay() expect.
+/// This is roughly a tenth of the bandwidth of decoded frames.
+///
+/// The camera parameters and the depth decoding tables of the device are
+/// written to <directory>/<prefix>.params, openReplay() applies the camera
+/// parameters from there. libfreenect2 has no public way to load the depth
+/// tables into a pipeline, so replays decode with its default P0 tables; the
+/// tables are kept in the file for tools that can use them.
+///
+/// Packets are copied into a bounded queue on the USB thread and written by a
+/// thread of their own. When the disk can't keep up the queue fills and new
+/// packets are dropped and counted, the USB thread never waits for the disk.
+class ofProtonectPacketRecorder: public libfreenect2::FrameListener, public ofThread
+{
+public:
+    /// \brief What a replay needs of the recorded device besides its packets.
+    struct DeviceParams
+    {
+        libfreenect2::Freenect2Device::IrCameraParams irParams;
+        libfreenect2::Freenect2Device::ColorCameraParams colorParams;
+        std::vector<unsigned char> p0Tables;
+        std::vector<float> xTable;
+        std::vector<float> zTable;
+        std::vector<short> lookupTable;
+    };
+
+    /// \brief Write device parameters, in the byte order of this machine.
+    /// \returns true if the file was written.
+    static bool saveDeviceParams(const std::string& path, const DeviceParams& params);
+
+    /// \brief Read device parameters written by saveDeviceParams().
+    /// \returns true if the file was read.
+    static bool loadDeviceParams(const std::string& path, DeviceParams& params);
+
+    /// \param maxQueueSize The number of packets that may wait to be written.
+    ofProtonectPacketRecorder(std::size_t maxQueueSize = 64);
+    virtual ~ofProtonectPacketRecorder();
+
+    /// \brief Open a device and start recording it.
+    /// \param serial The serial number of the device, empty for the default one.
+    /// \param directory The directory to write to, created if needed.
+    /// \param prefix The file name prefix, the serial number if empty.
+    /// \param recordColor Record the color stream.
+    /// \param recordDepth Record the depth stream.
+    /// \returns true if the device was opened and started.
+    bool open(const std::string& serial,
+              const std::string& directory,
+              const std::string& prefix = "",
+              bool recordColor = true,
+              bool recordDepth = true);
+
+    /// \brief Stop the device and write out the packets still queued.
+    void close();
+
+    bool isRecording() const;
+
+    /// \returns the serial number of the device being recorded.
+    std::string getSerial() const;
+
+    /// \returns the path the device parameters are written to.
+    std::string getParamsPath() const;
+
+    /// \returns the number of packets waiting to be written.
+    std::size_t getNumQueuedPackets() const;
+
+    /// \returns the number of packets written to disk.
+    uint64_t getNumWrittenPackets() const;
+
+    /// \returns the number of bytes written to disk.
+    uint64_t getNumWrittenBytes() const;
+
+    /// \returns the number of packets of the given type that were dropped.
+    uint64_t getNumDroppedPackets(libfreenect2::Frame::Type type) const;
+
+    /// \returns the number of packets of all types that were dropped, including
+    /// those that failed to write.
+    uint64_t getNumDroppedPackets() const;
+
+    /// \returns the number of packets that could not be written.
+    uint64_t getNumFailedWrites() const;
+
+    bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame* frame) override;
+
+protected:
+    void threadedFunction() override;
+
+    struct Packet
+    {
+        libfreenect2::Frame::Type type;
+        uint32_t timestamp = 0;
+        uint32_t sequence = 0;
+        std::vector<unsigned char> data;
+    };
+
+    /// \returns the path a packet is written to.
+    std::string getPacketPath(const Packet& packet) const;
+
+    libfreenect2::Freenect2 freenect2;
+    libfreenect2::Freenect2Device* dev = nullptr;
+    // Owned by dev.
+    libfreenect2::DumpPacketPipeline* pipeline = nullptr;
+
+    std::string serial;
+    std::string directory;
+    std::string prefix;
+
+    std::size_t maxQueueSize;
+
+    mutable std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<Packet> queue;
+
+    // Buffers of written packets, reused so recording doesn't allocate.
+    std::vector<std::vector<unsigned char>> freeBuffers;
+
+    std::atomic<uint64_t> numWrittenPackets;
+    std::atomic<uint64_t> numWrittenBytes;
+    std::atomic<uint64_t> numDroppedColor;
+    std::atomic<uint64_t> numDroppedDepth;
+    std::atomic<uint64_t> numFailedWrites;
+
+    ofProtonectPacketRecorder(const ofProtonectPacketRecorder&) = delete;
+    ofProtonectPacketRecorder& operator=(const ofProtonectPacketRecorder&) = delete;
+};
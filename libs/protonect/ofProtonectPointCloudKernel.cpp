@@ -0,0 +1,639 @@
+//  ofProtonectPointCloudKernel.cpp
+
+
+#include "ofProtonectPointCloudKernel.h"
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OF_PROTONECT_POINT_CLOUD_SSE
+#endif
+
+
+namespace
+{
+    /// ofVec3f * ofMatrix4x4 of (1000 x, -1000 y, -1000 z), as a matrix that
+    /// applies to (x, y, z) in meters directly.
+    struct FoldedTransform
+    {
+        FoldedTransform(const ofMatrix4x4& transform)
+        {
+            const float* values = transform.getPtr();
+            const float scale[4] = { 1000, -1000, -1000, 1 };
+
+            for (int i = 0; i < 4; i++)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    m[i][j] = values[i * 4 + j] * scale[i];
+                }
+            }
+
+            projective = m[0][3] != 0 || m[1][3] != 0 || m[2][3] != 0 || m[3][3] != 1;
+        }
+
+        float m[4][4];
+        bool projective;
+    };
+
+    const float MIN_DEPTH_IN_METERS = 0.001f;
+}
+
+
+void ofProtonectPointCloudKernel::setup(const libfreenect2::Freenect2Device::IrCameraParams& params,
+                                        std::size_t _width,
+                                        std::size_t _height,
+                                        std::size_t _steps)
+{
+    irParams = params;
+    imageWidth = _width;
+    imageHeight = _height;
+    steps = std::max<std::size_t>(_steps, 1);
+    width = (imageWidth + steps - 1) / steps;
+    height = (imageHeight + steps - 1) / steps;
+
+    // Same types as Registration::getPointXYZ(): the reciprocals are floats,
+    // the sums are promoted to double.
+    const float cx(params.cx);
+    const float cy(params.cy);
+    const float fx(1 / params.fx);
+    const float fy(1 / params.fy);
+
+    raysX.resize(width);
+    raysY.resize(height);
+    raysXFloat.resize(width);
+    raysYFloat.resize(height);
+
+    for (std::size_t c = 0; c < width; c++)
+    {
+        raysX[c] = (int(c * steps) + 0.5 - cx) * fx;
+        raysXFloat[c] = static_cast<float>(raysX[c]);
+    }
+
+    for (std::size_t r = 0; r < height; r++)
+    {
+        raysY[r] = (int(r * steps) + 0.5 - cy) * fy;
+        raysYFloat[r] = static_cast<float>(raysY[r]);
+    }
+
+    rayLengths.resize(width * height);
+
+    for (std::size_t r = 0; r < height; r++)
+    {
+        for (std::size_t c = 0; c < width; c++)
+        {
+            rayLengths[r * width + c] = static_cast<float>(std::sqrt(raysX[c] * raysX[c] + raysY[r] * raysY[r] + 1));
+        }
+    }
+}
+
+
+bool ofProtonectPointCloudKernel::isSetup() const
+{
+    return width > 0;
+}
+
+
+std::size_t ofProtonectPointCloudKernel::getWidth() const
+{
+    return width;
+}
+
+
+std::size_t ofProtonectPointCloudKernel::getHeight() const
+{
+    return height;
+}
+
+
+std::size_t ofProtonectPointCloudKernel::getImageWidth() const
+{
+    return imageWidth;
+}
+
+
+std::size_t ofProtonectPointCloudKernel::getImageHeight() const
+{
+    return imageHeight;
+}
+
+
+std::size_t ofProtonectPointCloudKernel::getSteps() const
+{
+    return steps;
+}
+
+
+const libfreenect2::Freenect2Device::IrCameraParams& ofProtonectPointCloudKernel::getIrCameraParams() const
+{
+    return irParams;
+}
+
+
+void ofProtonectPointCloudKernel::setDepthRange(float _minDepth, float _maxDepth)
+{
+    minDepth = _minDepth;
+    maxDepth = _maxDepth;
+}
+
+
+float ofProtonectPointCloudKernel::getMinDepth() const
+{
+    return minDepth;
+}
+
+
+float ofProtonectPointCloudKernel::getMaxDepth() const
+{
+    return maxDepth;
+}
+
+
+float ofProtonectPointCloudKernel::getDepthInMeters(float depth) const
+{
+    // Scaling factor, so that a value of 1 is one meter.
+    const float value = depth / 1000.0f;
+
+    // Also catches NaN, which fails the comparisons.
+    return value > 0.001 && depth >= minDepth && depth <= maxDepth ? value : std::numeric_limits<float>::quiet_NaN();
+}
+
+
+void ofProtonectPointCloudKernel::decimateDepth(const float* undistorted,
+                                                Decimation decimation,
+                                                float* decimated,
+                                                std::size_t rowBegin,
+                                                std::size_t rowEnd) const
+{
+    rowEnd = std::min(rowEnd, height);
+
+    std::vector<float> block;
+    block.reserve(steps * steps);
+
+    for (std::size_t r = rowBegin; r < rowEnd; r++)
+    {
+        const std::size_t y = r * steps;
+        const std::size_t blockHeight = std::min(steps, imageHeight - y);
+
+        for (std::size_t c = 0; c < width; c++)
+        {
+            const std::size_t x = c * steps;
+            const float* topLeft = undistorted + y * imageWidth + x;
+
+            if (decimation == Decimation::NONE || decimation == Decimation::SUBSAMPLE)
+            {
+                decimated[r * width + c] = *topLeft;
+                continue;
+            }
+
+            const std::size_t blockWidth = std::min(steps, imageWidth - x);
+            block.clear();
+
+            for (std::size_t j = 0; j < blockHeight; j++)
+            {
+                for (std::size_t i = 0; i < blockWidth; i++)
+                {
+                    const float depth = topLeft[j * imageWidth + i];
+
+                    if (!std::isnan(getDepthInMeters(depth)))
+                    {
+                        block.push_back(depth);
+                    }
+                }
+            }
+
+            float value = 0;
+
+            if (!block.empty() && decimation == Decimation::MIN)
+            {
+                value = *std::min_element(block.begin(), block.end());
+            }
+            else if (!block.empty())
+            {
+                std::vector<float>::iterator median = block.begin() + block.size() / 2;
+                std::nth_element(block.begin(), median, block.end());
+                value = *median;
+            }
+
+            decimated[r * width + c] = value;
+        }
+    }
+}
+
+
+void ofProtonectPointCloudKernel::decimateColors(const unsigned char* registered,
+                                                 unsigned char* decimated,
+                                                 std::size_t rowBegin,
+                                                 std::size_t rowEnd) const
+{
+    rowEnd = std::min(rowEnd, height);
+
+    const uint32_t* source = reinterpret_cast<const uint32_t*>(registered);
+    uint32_t* destination = reinterpret_cast<uint32_t*>(decimated);
+
+    for (std::size_t r = rowBegin; r < rowEnd; r++)
+    {
+        const uint32_t* sourceRow = source + r * steps * imageWidth;
+        uint32_t* destinationRow = destination + r * width;
+
+        for (std::size_t c = 0; c < width; c++)
+        {
+            destinationRow[c] = sourceRow[c * steps];
+        }
+    }
+}
+
+
+void ofProtonectPointCloudKernel::computeVertices(const float* undistorted, glm::vec3* vertices) const
+{
+    computeVertices(undistorted, vertices, 0, height);
+}
+
+
+void ofProtonectPointCloudKernel::computeVertices(const float* undistorted,
+                                                  glm::vec3* vertices,
+                                                  std::size_t rowBegin,
+                                                  std::size_t rowEnd) const
+{
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "vertices are read as three floats");
+    computePoints<3>(undistorted, reinterpret_cast<float*>(vertices), rowBegin, rowEnd);
+}
+
+
+void ofProtonectPointCloudKernel::computePoints(const float* undistorted,
+                                                float* points,
+                                                std::size_t channels,
+                                                std::size_t rowBegin,
+                                                std::size_t rowEnd) const
+{
+    if (channels == 4)
+    {
+        computePoints<4>(undistorted, points, rowBegin, rowEnd);
+    }
+    else
+    {
+        computePoints<3>(undistorted, points, rowBegin, rowEnd);
+    }
+}
+
+
+template<std::size_t CHANNELS>
+void ofProtonectPointCloudKernel::computePoints(const float* undistorted,
+                                                float* points,
+                                                std::size_t rowBegin,
+                                                std::size_t rowEnd) const
+{
+    rowEnd = std::min(rowEnd, height);
+
+    for (std::size_t r = rowBegin; r < rowEnd; r++)
+    {
+        const double rayY = raysY[r];
+        const float* depthRow = undistorted + r * width;
+        float* pointRow = points + r * width * CHANNELS;
+
+        for (std::size_t c = 0; c < width; c++)
+        {
+            const float z = getDepthInMeters(depthRow[c]);
+            const float x = static_cast<float>(raysX[c] * z);
+            const float y = static_cast<float>(rayY * z);
+
+            float* point = pointRow + c * CHANNELS;
+            point[0] = x * 1000;
+            point[1] = y * -1000;
+            point[2] = z * -1000;
+        }
+    }
+}
+
+
+void ofProtonectPointCloudKernel::computeVertices(const float* undistorted, const ofMatrix4x4& transform, glm::vec3* vertices) const
+{
+    computeVertices(undistorted, transform, vertices, 0, height);
+}
+
+
+void ofProtonectPointCloudKernel::computeVertices(const float* undistorted,
+                                                  const ofMatrix4x4& transform,
+                                                  glm::vec3* vertices,
+                                                  std::size_t rowBegin,
+                                                  std::size_t rowEnd) const
+{
+    computePoints<3>(undistorted, transform, reinterpret_cast<float*>(vertices), rowBegin, rowEnd);
+}
+
+
+void ofProtonectPointCloudKernel::computePoints(const float* undistorted,
+                                                const ofMatrix4x4& transform,
+                                                float* points,
+                                                std::size_t channels,
+                                                std::size_t rowBegin,
+                                                std::size_t rowEnd) const
+{
+    if (channels == 4)
+    {
+        computePoints<4>(undistorted, transform, points, rowBegin, rowEnd);
+    }
+    else
+    {
+        computePoints<3>(undistorted, transform, points, rowBegin, rowEnd);
+    }
+}
+
+
+template<std::size_t CHANNELS>
+void ofProtonectPointCloudKernel::computePoints(const float* undistorted,
+                                                const ofMatrix4x4& transform,
+                                                float* points,
+                                                std::size_t rowBegin,
+                                                std::size_t rowEnd) const
+{
+    rowEnd = std::min(rowEnd, height);
+
+    const FoldedTransform folded(transform);
+    const float (&m)[4][4] = folded.m;
+
+#if defined(__AVX__)
+    const std::size_t batchSize = 8;
+    typedef __m256 Batch;
+    #define OF_PROTONECT_BATCH(op, ...) _mm256_##op##_ps(__VA_ARGS__)
+#elif defined(OF_PROTONECT_POINT_CLOUD_SSE)
+    const std::size_t batchSize = 4;
+    typedef __m128 Batch;
+    #define OF_PROTONECT_BATCH(op, ...) _mm_##op##_ps(__VA_ARGS__)
+#endif
+
+    for (std::size_t r = rowBegin; r < rowEnd; r++)
+    {
+        const float rayY = raysYFloat[r];
+        const float* depthRow = undistorted + r * width;
+        float* pointRow = points + r * width * CHANNELS;
+
+        std::size_t c = 0;
+
+#if defined(OF_PROTONECT_BATCH)
+        // Structure of arrays: each register holds one coordinate of a batch
+        // of pixels, every matrix entry is broadcast once per row.
+        const Batch thousand = OF_PROTONECT_BATCH(set1, 1000.0f);
+        const Batch minDepthInMeters = OF_PROTONECT_BATCH(set1, MIN_DEPTH_IN_METERS);
+        const Batch minDepthBatch = OF_PROTONECT_BATCH(set1, minDepth);
+        const Batch maxDepthBatch = OF_PROTONECT_BATCH(set1, maxDepth);
+        const Batch invalid = OF_PROTONECT_BATCH(set1, std::numeric_limits<float>::quiet_NaN());
+        const Batch rayYBatch = OF_PROTONECT_BATCH(set1, rayY);
+
+        Batch matrix[4][4];
+
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                matrix[i][j] = OF_PROTONECT_BATCH(set1, m[i][j]);
+            }
+        }
+
+        float out[3][batchSize];
+
+        for (; c + batchSize <= width; c += batchSize)
+        {
+            const Batch depth = OF_PROTONECT_BATCH(loadu, depthRow + c);
+            Batch z = OF_PROTONECT_BATCH(div, depth, thousand);
+
+#if defined(__AVX__)
+            Batch valid = _mm256_and_ps(_mm256_cmp_ps(z, minDepthInMeters, _CMP_GT_OQ),
+                                        _mm256_and_ps(_mm256_cmp_ps(depth, minDepthBatch, _CMP_GE_OQ),
+                                                      _mm256_cmp_ps(depth, maxDepthBatch, _CMP_LE_OQ)));
+#else
+            Batch valid = _mm_and_ps(_mm_cmpgt_ps(z, minDepthInMeters),
+                                     _mm_and_ps(_mm_cmpge_ps(depth, minDepthBatch),
+                                                _mm_cmple_ps(depth, maxDepthBatch)));
+#endif
+            z = OF_PROTONECT_BATCH(or, OF_PROTONECT_BATCH(and, valid, z), OF_PROTONECT_BATCH(andnot, valid, invalid));
+
+            Batch x = OF_PROTONECT_BATCH(mul, OF_PROTONECT_BATCH(loadu, raysXFloat.data() + c), z);
+            Batch y = OF_PROTONECT_BATCH(mul, rayYBatch, z);
+
+            Batch transformed[3];
+
+            for (int j = 0; j < 3; j++)
+            {
+                transformed[j] = OF_PROTONECT_BATCH(add,
+                    OF_PROTONECT_BATCH(add, OF_PROTONECT_BATCH(mul, matrix[0][j], x), OF_PROTONECT_BATCH(mul, matrix[1][j], y)),
+                    OF_PROTONECT_BATCH(add, OF_PROTONECT_BATCH(mul, matrix[2][j], z), matrix[3][j]));
+            }
+
+            if (folded.projective)
+            {
+                Batch w = OF_PROTONECT_BATCH(add,
+                    OF_PROTONECT_BATCH(add, OF_PROTONECT_BATCH(mul, matrix[0][3], x), OF_PROTONECT_BATCH(mul, matrix[1][3], y)),
+                    OF_PROTONECT_BATCH(add, OF_PROTONECT_BATCH(mul, matrix[2][3], z), matrix[3][3]));
+
+                for (int j = 0; j < 3; j++)
+                {
+                    transformed[j] = OF_PROTONECT_BATCH(div, transformed[j], w);
+                }
+            }
+
+            for (int j = 0; j < 3; j++)
+            {
+                OF_PROTONECT_BATCH(storeu, out[j], transformed[j]);
+            }
+
+            // Back to the interleaved layout of the mesh.
+            for (std::size_t i = 0; i < batchSize; i++)
+            {
+                float* point = pointRow + (c + i) * CHANNELS;
+                point[0] = out[0][i];
+                point[1] = out[1][i];
+                point[2] = out[2][i];
+            }
+        }
+#endif
+
+        for (; c < width; c++)
+        {
+            const float depth = depthRow[c];
+            float z = depth / 1000.0f;
+            z = z > MIN_DEPTH_IN_METERS && depth >= minDepth && depth <= maxDepth ? z : std::numeric_limits<float>::quiet_NaN();
+
+            const float x = raysXFloat[c] * z;
+            const float y = rayY * z;
+
+            float transformed[3];
+
+            for (int j = 0; j < 3; j++)
+            {
+                transformed[j] = (m[0][j] * x + m[1][j] * y) + (m[2][j] * z + m[3][j]);
+            }
+
+            if (folded.projective)
+            {
+                const float w = (m[0][3] * x + m[1][3] * y) + (m[2][3] * z + m[3][3]);
+
+                for (int j = 0; j < 3; j++)
+                {
+                    transformed[j] /= w;
+                }
+            }
+
+            float* point = pointRow + c * CHANNELS;
+            point[0] = transformed[0];
+            point[1] = transformed[1];
+            point[2] = transformed[2];
+        }
+    }
+
+#undef OF_PROTONECT_BATCH
+}
+
+
+void ofProtonectPointCloudKernel::computeCameraPoints(const float* undistorted,
+                                                      const glm::ivec2* pixels,
+                                                      std::size_t numPixels,
+                                                      glm::vec3* points) const
+{
+    const float invalid = std::numeric_limits<float>::quiet_NaN();
+
+    for (std::size_t i = 0; i < numPixels; i++)
+    {
+        const glm::ivec2& pixel = pixels[i];
+
+        if (pixel.x < 0 || pixel.y < 0 || std::size_t(pixel.x) >= width || std::size_t(pixel.y) >= height)
+        {
+            points[i] = glm::vec3(invalid, invalid, invalid);
+            continue;
+        }
+
+        // Compared in double like Registration::getPointXYZ().
+        const float z = undistorted[pixel.y * width + pixel.x] / 1000.0f;
+
+        if (std::isnan(z) || z <= 0.001)
+        {
+            points[i] = glm::vec3(invalid, invalid, invalid);
+            continue;
+        }
+
+        points[i] = glm::vec3(static_cast<float>(raysX[pixel.x] * z), static_cast<float>(raysY[pixel.y] * z), z);
+    }
+}
+
+
+void ofProtonectPointCloudKernel::computeCameraPoints(const float* undistorted,
+                                                      float* points,
+                                                      std::size_t rowBegin,
+                                                      std::size_t rowEnd) const
+{
+    const float invalid = std::numeric_limits<float>::quiet_NaN();
+
+    for (std::size_t y = rowBegin; y < std::min(rowEnd, height); y++)
+    {
+        const float* depthRow = undistorted + y * width;
+        float* point = points + y * width * 3;
+
+        for (std::size_t x = 0; x < width; x++, point += 3)
+        {
+            // Compared in double like Registration::getPointXYZ().
+            const float z = depthRow[x] / 1000.0f;
+
+            if (std::isnan(z) || z <= 0.001)
+            {
+                point[0] = invalid;
+                point[1] = invalid;
+                point[2] = invalid;
+                continue;
+            }
+
+            point[0] = static_cast<float>(raysX[x] * z);
+            point[1] = static_cast<float>(raysY[y] * z);
+            point[2] = z;
+        }
+    }
+}
+
+
+void ofProtonectPointCloudKernel::computeDistances(const float* undistorted,
+                                                   float* distances,
+                                                   std::size_t rowBegin,
+                                                   std::size_t rowEnd) const
+{
+    const std::size_t pixelEnd = std::min(rowEnd, height) * width;
+    const float* lengths = rayLengths.data();
+
+    // A select instead of a branch, so this vectorizes.
+    for (std::size_t i = rowBegin * width; i < pixelEnd; i++)
+    {
+        const float depth = undistorted[i];
+        distances[i] = depth / 1000.0f > MIN_DEPTH_IN_METERS ? depth * lengths[i] : 0.0f;
+    }
+}
+
+
+float ofProtonectPointCloudKernel::computeDistance(const float* undistorted, std::size_t x, std::size_t y) const
+{
+    if (x >= width || y >= height)
+    {
+        return 0.0f;
+    }
+
+    const std::size_t i = y * width + x;
+    const float depth = undistorted[i];
+
+    return depth / 1000.0f > MIN_DEPTH_IN_METERS ? depth * rayLengths[i] : 0.0f;
+}
+
+
+void ofProtonectPointCloudKernel::computeColors(const float* undistorted,
+                                                const unsigned char* registered,
+                                                unsigned char alpha,
+                                                ofFloatColor* colors) const
+{
+    computeColors(undistorted, registered, alpha, colors, 0, height);
+}
+
+
+void ofProtonectPointCloudKernel::computeColors(const float* undistorted,
+                                                const unsigned char* registered,
+                                                unsigned char alpha,
+                                                ofFloatColor* colors,
+                                                std::size_t rowBegin,
+                                                std::size_t rowEnd) const
+{
+    const std::size_t pixelEnd = std::min(rowEnd, height) * width;
+    const ofColor invalid(0, 0, 0, alpha);
+
+    for (std::size_t i = rowBegin * width; i < pixelEnd; i++)
+    {
+        if (std::isnan(getDepthInMeters(undistorted[i])))
+        {
+            colors[i] = invalid;
+        }
+        else
+        {
+            const unsigned char* bgrx = registered + 4 * i;
+            colors[i] = ofColor(bgrx[2], bgrx[1], bgrx[0], alpha);
+        }
+    }
+}
+
+
+void ofProtonectPointCloudKernel::computePackedColors(const unsigned char* registered,
+                                                      float* points,
+                                                      std::size_t rowBegin,
+                                                      std::size_t rowEnd) const
+{
+    const std::size_t pixelEnd = std::min(rowEnd, height) * width;
+
+    for (std::size_t i = rowBegin * width; i < pixelEnd; i++)
+    {
+        const unsigned char* bgrx = registered + 4 * i;
+
+        // 0x00RRGGBB, a zero top byte keeps the float from being a NaN.
+        const uint32_t packed = (uint32_t(bgrx[2]) << 16) | (uint32_t(bgrx[1]) << 8) | uint32_t(bgrx[0]);
+        std::memcpy(points + 4 * i + 3, &packed, sizeof(packed));
+    }
+}
@@ -0,0 +1,275 @@
+//  ofProtonectPointCloudKernel.h
+//
+//  Turns undistorted depth into point cloud vertices using precomputed rays.
+
+
+#pragma once
+
+
+#include "ofMain.h"
+
+#include <libfreenect2/libfreenect2.hpp>
+
+#include <limits>
+
+
+/// \brief Computes the point cloud of an undistorted depth image.
+///
+/// libfreenect2::Registration::getPointXYZ() derives the ray of a pixel from
+/// the depth camera intrinsics every time it is called. The undistorted image
+/// is a pinhole image, so the ray of a pixel only depends on its column (x/z)
+/// and its row (y/z). Both tables are computed once by setup() and a frame
+/// then is a single pass of multiplications over the depth buffer.
+///
+/// The results are bit identical to Registration::getPointXYZRGB() followed
+/// by the scaling ofProtonect applies: the rays are kept in double precision
+/// and the operations happen in the same order as in libfreenect2.
+class ofProtonectPointCloudKernel
+{
+public:
+    /// \brief How a block of depth pixels is reduced to one when decimating.
+    enum class Decimation
+    {
+        /// Keep the full resolution.
+        NONE,
+        /// The top left pixel of the block.
+        SUBSAMPLE,
+        /// The closest valid depth in the block.
+        MIN,
+        /// The median of the valid depths in the block.
+        MEDIAN
+    };
+
+    /// \brief Precompute the rays of the depth camera.
+    /// \param params The depth camera intrinsics.
+    /// \param width The width of the depth image.
+    /// \param height The height of the depth image.
+    /// \param steps Only compute a vertex for every steps-th column and row.
+    void setup(const libfreenect2::Freenect2Device::IrCameraParams& params,
+               std::size_t width = 512,
+               std::size_t height = 424,
+               std::size_t steps = 1);
+
+    bool isSetup() const;
+
+    /// \returns the width of the vertex grid, the image width divided by steps.
+    std::size_t getWidth() const;
+
+    /// \returns the height of the vertex grid, the image height divided by steps.
+    std::size_t getHeight() const;
+
+    std::size_t getImageWidth() const;
+    std::size_t getImageHeight() const;
+    std::size_t getSteps() const;
+
+    const libfreenect2::Freenect2Device::IrCameraParams& getIrCameraParams() const;
+
+    /// \brief Only compute vertices for depth within [minDepth, maxDepth].
+    ///
+    /// Depth outside the range is treated like invalid depth. Defaults to
+    /// every positive depth.
+    /// \param minDepth The closest depth in millimeters.
+    /// \param maxDepth The farthest depth in millimeters.
+    void setDepthRange(float minDepth, float maxDepth);
+
+    float getMinDepth() const;
+    float getMaxDepth() const;
+
+    /// \brief Reduce every steps x steps block of a depth image to one pixel.
+    ///
+    /// Only depth in the depth range counts for MIN and MEDIAN, a block
+    /// without any becomes 0. The vertices of the result lie on the rays of
+    /// the top left pixels of the blocks.
+    /// \param undistorted The undistorted depth image in millimeters.
+    /// \param decimation How blocks are reduced.
+    /// \param decimated Receives getWidth() * getHeight() depth values.
+    /// \param rowBegin The first row of the vertex grid to compute.
+    /// \param rowEnd The row after the last one.
+    void decimateDepth(const float* undistorted,
+                       Decimation decimation,
+                       float* decimated,
+                       std::size_t rowBegin,
+                       std::size_t rowEnd) const;
+
+    /// \brief Pick the color of the top left pixel of every steps x steps block.
+    /// \param registered The registered BGRX color of the depth image.
+    /// \param decimated Receives getWidth() * getHeight() BGRX colors.
+    void decimateColors(const unsigned char* registered,
+                        unsigned char* decimated,
+                        std::size_t rowBegin,
+                        std::size_t rowEnd) const;
+
+    /// \brief Compute a vertex for every pixel.
+    ///
+    /// Vertices are in millimeters with y and z flipped, the way ofProtonect
+    /// presents its point cloud. Invalid depth, or depth outside the depth
+    /// range, yields NaN vertices.
+    /// \param undistorted The undistorted depth in millimeters, decimated if
+    ///        steps is more than 1.
+    /// \param vertices Receives width * height vertices.
+    void computeVertices(const float* undistorted, glm::vec3* vertices) const;
+
+    /// \brief Compute the vertices of the rows in [rowBegin, rowEnd) only.
+    ///
+    /// The buffers still hold the whole image, so bands of rows can be
+    /// computed by different threads at once.
+    void computeVertices(const float* undistorted,
+                         glm::vec3* vertices,
+                         std::size_t rowBegin,
+                         std::size_t rowEnd) const;
+
+    /// \brief Compute a transformed vertex for every pixel.
+    ///
+    /// Equivalent to transforming the vertices of computeVertices() with
+    /// ofVec3f * transform, but the millimeter scale and the flips are folded
+    /// into the matrix and the pixels are processed in SIMD batches (AVX when
+    /// compiled in, otherwise SSE, scalar elsewhere). This is single precision,
+    /// so the results are not bit identical to the scalar path.
+    /// \param undistorted The undistorted depth in millimeters.
+    /// \param transform The transformation to apply to the vertices.
+    /// \param vertices Receives width * height vertices.
+    void computeVertices(const float* undistorted, const ofMatrix4x4& transform, glm::vec3* vertices) const;
+
+    /// \brief Compute the transformed vertices of the rows in [rowBegin, rowEnd) only.
+    void computeVertices(const float* undistorted,
+                         const ofMatrix4x4& transform,
+                         glm::vec3* vertices,
+                         std::size_t rowBegin,
+                         std::size_t rowEnd) const;
+
+    /// \brief Compute an organized point cloud of the rows in [rowBegin, rowEnd).
+    ///
+    /// Every pixel gets the vertex computeVertices() computes for it, so
+    /// neighbours stay addressable by their pixel position.
+    /// \param undistorted The undistorted depth in millimeters.
+    /// \param points Receives width * height pixels of channels floats, x, y
+    ///        and z first.
+    /// \param channels 3, or 4 to leave room for computePackedColors().
+    void computePoints(const float* undistorted,
+                       float* points,
+                       std::size_t channels,
+                       std::size_t rowBegin,
+                       std::size_t rowEnd) const;
+
+    /// \brief Compute a transformed organized point cloud of the rows in [rowBegin, rowEnd).
+    void computePoints(const float* undistorted,
+                       const ofMatrix4x4& transform,
+                       float* points,
+                       std::size_t channels,
+                       std::size_t rowBegin,
+                       std::size_t rowEnd) const;
+
+    /// \brief Store the registered color in the fourth channel of an organized point cloud.
+    ///
+    /// Colors are packed as 0x00RRGGBB and stored in the bits of the float,
+    /// the way PCL packs rgb.
+    /// \param registered The registered BGRX color.
+    /// \param points The width * height pixels of four floats.
+    void computePackedColors(const unsigned char* registered,
+                             float* points,
+                             std::size_t rowBegin,
+                             std::size_t rowEnd) const;
+
+    /// \brief Compute the camera space points of single pixels.
+    ///
+    /// The results are bit identical to Registration::getPointXYZ(): meters
+    /// in the depth camera's coordinate system, NaN where the depth is
+    /// invalid. The depth range doesn't apply, so this may be called from
+    /// another thread than the one computing vertices. Pixels outside the
+    /// image are NaN as well.
+    /// \param undistorted The undistorted depth in millimeters.
+    /// \param pixels The pixel positions, x is the column and y the row.
+    /// \param numPixels The number of pixel positions.
+    /// \param points Receives numPixels points.
+    void computeCameraPoints(const float* undistorted,
+                             const glm::ivec2* pixels,
+                             std::size_t numPixels,
+                             glm::vec3* points) const;
+
+    /// \brief Compute the camera space points of every pixel in the rows in [rowBegin, rowEnd).
+    ///
+    /// Bit identical to Registration::getPointXYZ() like the single pixel
+    /// version, and likewise ignores the depth range.
+    /// \param undistorted The undistorted depth in millimeters.
+    /// \param points Receives width * height pixels of three floats, x, y and z.
+    void computeCameraPoints(const float* undistorted,
+                             float* points,
+                             std::size_t rowBegin,
+                             std::size_t rowEnd) const;
+
+    /// \brief Compute the distance of every pixel from the camera, for the rows in [rowBegin, rowEnd).
+    ///
+    /// That is the depth times the length of the pixel's ray, a single
+    /// multiplication with a precomputed table per pixel. Unlike the
+    /// vertices it ignores the depth range.
+    /// \param undistorted The undistorted depth in millimeters.
+    /// \param distances Receives width * height distances in millimeters,
+    ///        0 where the depth is invalid.
+    void computeDistances(const float* undistorted,
+                          float* distances,
+                          std::size_t rowBegin,
+                          std::size_t rowEnd) const;
+
+    /// \brief Compute the distance of a single pixel like computeDistances().
+    /// \returns the distance in millimeters, 0 where the depth is invalid or
+    ///          the pixel is outside the image.
+    float computeDistance(const float* undistorted, std::size_t x, std::size_t y) const;
+
+    /// \brief Look up the registered color of every pixel.
+    /// \param undistorted The undistorted depth in millimeters.
+    /// \param registered The registered BGRX color.
+    /// \param alpha The alpha of every color.
+    /// \param colors Receives width * height colors, black where the depth is invalid.
+    void computeColors(const float* undistorted,
+                       const unsigned char* registered,
+                       unsigned char alpha,
+                       ofFloatColor* colors) const;
+
+    /// \brief Look up the colors of the rows in [rowBegin, rowEnd) only.
+    void computeColors(const float* undistorted,
+                       const unsigned char* registered,
+                       unsigned char alpha,
+                       ofFloatColor* colors,
+                       std::size_t rowBegin,
+                       std::size_t rowEnd) const;
+
+private:
+    template<std::size_t CHANNELS>
+    void computePoints(const float* undistorted,
+                       float* points,
+                       std::size_t rowBegin,
+                       std::size_t rowEnd) const;
+
+    template<std::size_t CHANNELS>
+    void computePoints(const float* undistorted,
+                       const ofMatrix4x4& transform,
+                       float* points,
+                       std::size_t rowBegin,
+                       std::size_t rowEnd) const;
+
+    /// \returns the depth in meters, NaN if it is invalid like in
+    /// Registration or outside the depth range.
+    float getDepthInMeters(float depth) const;
+
+    libfreenect2::Freenect2Device::IrCameraParams irParams;
+
+    std::size_t width = 0;
+    std::size_t height = 0;
+    std::size_t imageWidth = 0;
+    std::size_t imageHeight = 0;
+    std::size_t steps = 1;
+
+    float minDepth = 0;
+    float maxDepth = std::numeric_limits<float>::infinity();
+
+    // (c + 0.5 - cx) / fx and (r + 0.5 - cy) / fy, computed like libfreenect2.
+    std::vector<double> raysX;
+    std::vector<double> raysY;
+
+    // The same in single precision for the SIMD path.
+    std::vector<float> raysXFloat;
+    std::vector<float> raysYFloat;
+
+    // The length of the ray of every pixel, sqrt(x^2 + y^2 + 1).
+    std::vector<float> rayLengths;
+};
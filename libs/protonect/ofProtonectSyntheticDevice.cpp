@@ -0,0 +1,526 @@
+//  ofProtonectSyntheticDevice.cpp
+
+
+#include "ofProtonectSyntheticDevice.h"
+
+
+#include <limits>
+
+
+namespace
+{
+    const std::size_t DEPTH_WIDTH = 512;
+    const std::size_t DEPTH_HEIGHT = 424;
+    const std::size_t COLOR_WIDTH = 1920;
+    const std::size_t COLOR_HEIGHT = 1080;
+
+    // The color image is ray cast at a quarter of its resolution.
+    const std::size_t COLOR_BLOCK = 4;
+
+    // Scene time advances at the nominal sensor rate, whatever the frame rate.
+    const float NOMINAL_FRAME_RATE = 30;
+
+    // Units of libfreenect2::Frame::timestamp per second.
+    const float TIMESTAMP_RATE = 8000;
+
+    // Constants of libfreenect2's registration formula.
+    const float DEPTH_Q = 0.01f;
+    const float COLOR_Q = 0.002199f;
+
+    const unsigned char OBJECT_COLORS[][3] =
+    {
+        { 200, 200, 190 }, // wall
+        { 120, 100, 80 },  // floor
+        { 220, 60, 50 },
+        { 60, 180, 80 },
+        { 70, 90, 220 }
+    };
+
+    bool intersectSphere(const glm::vec3& origin,
+                         const glm::vec3& direction,
+                         const glm::vec3& center,
+                         float radius,
+                         float& t,
+                         glm::vec3& normal)
+    {
+        glm::vec3 oc(origin.x - center.x, origin.y - center.y, origin.z - center.z);
+
+        float a = direction.x * direction.x + direction.y * direction.y + direction.z * direction.z;
+        float b = oc.x * direction.x + oc.y * direction.y + oc.z * direction.z;
+        float c = oc.x * oc.x + oc.y * oc.y + oc.z * oc.z - radius * radius;
+        float discriminant = b * b - a * c;
+
+        if (discriminant < 0)
+        {
+            return false;
+        }
+
+        t = (-b - std::sqrt(discriminant)) / a;
+
+        if (t <= 0)
+        {
+            return false;
+        }
+
+        normal = glm::vec3((oc.x + t * direction.x) / radius,
+                           (oc.y + t * direction.y) / radius,
+                           (oc.z + t * direction.z) / radius);
+        return true;
+    }
+
+    bool intersectBox(const glm::vec3& origin,
+                      const glm::vec3& direction,
+                      const glm::vec3& center,
+                      const glm::vec3& halfSize,
+                      float& t,
+                      glm::vec3& normal)
+    {
+        float tNear = -std::numeric_limits<float>::max();
+        float tFar = std::numeric_limits<float>::max();
+        int nearAxis = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float lo = center[axis] - halfSize[axis] - origin[axis];
+            float hi = center[axis] + halfSize[axis] - origin[axis];
+
+            if (direction[axis] == 0)
+            {
+                if (lo > 0 || hi < 0) return false;
+                continue;
+            }
+
+            float t0 = lo / direction[axis];
+            float t1 = hi / direction[axis];
+
+            if (t0 > t1) std::swap(t0, t1);
+
+            if (t0 > tNear)
+            {
+                tNear = t0;
+                nearAxis = axis;
+            }
+
+            tFar = std::min(tFar, t1);
+        }
+
+        if (tNear > tFar || tNear <= 0)
+        {
+            return false;
+        }
+
+        t = tNear;
+        normal = glm::vec3(0, 0, 0);
+        normal[nearAxis] = direction[nearAxis] > 0 ? -1 : 1;
+        return true;
+    }
+}
+
+
+ofProtonectSyntheticDevice::ofProtonectSyntheticDevice(Scene _scene, float _frameRate):
+    scene(_scene),
+    frameRate(_frameRate),
+    irParams(getDefaultIrCameraParams()),
+    colorParams(getDefaultColorCameraParams())
+{
+}
+
+
+ofProtonectSyntheticDevice::~ofProtonectSyntheticDevice()
+{
+    close();
+}
+
+
+void ofProtonectSyntheticDevice::setFrameRate(float _frameRate)
+{
+    frameRate = _frameRate;
+}
+
+
+float ofProtonectSyntheticDevice::getFrameRate() const
+{
+    return frameRate;
+}
+
+
+float ofProtonectSyntheticDevice::getTime(uint32_t sequence)
+{
+    return sequence / NOMINAL_FRAME_RATE;
+}
+
+
+float ofProtonectSyntheticDevice::castRay(const glm::vec3& origin, const glm::vec3& direction, float time, float& shade, int& object) const
+{
+    float nearest = std::numeric_limits<float>::max();
+    glm::vec3 nearestNormal;
+    object = -1;
+
+    auto consider = [&](float t, const glm::vec3& normal, int index)
+    {
+        if (t > 0 && t < nearest)
+        {
+            nearest = t;
+            nearestNormal = normal;
+            object = index;
+        }
+    };
+
+    float t;
+    glm::vec3 normal;
+
+    if (scene == Scene::PLANE)
+    {
+        consider((2000 - origin.z) / direction.z, glm::vec3(0, 0, -1), 0);
+    }
+    else
+    {
+        // Back wall and floor, y points down like the image rows.
+        consider((4500 - origin.z) / direction.z, glm::vec3(0, 0, -1), 0);
+
+        if (direction.y > 0)
+        {
+            consider((1000 - origin.y) / direction.y, glm::vec3(0, -1, 0), 1);
+        }
+    }
+
+    if (scene == Scene::SPHERES)
+    {
+        if (intersectSphere(origin, direction, glm::vec3(-700, 200, 2600), 450, t, normal)) consider(t, normal, 2);
+        if (intersectSphere(origin, direction, glm::vec3(600, -150, 3200), 600, t, normal)) consider(t, normal, 3);
+
+        float bounce = 1000 - 250 - 500 * std::abs(std::sin(time * 2.0f));
+        if (intersectSphere(origin, direction, glm::vec3(0, bounce, 1800), 250, t, normal)) consider(t, normal, 4);
+    }
+    else if (scene == Scene::MOVING_BOXES)
+    {
+        glm::vec3 first(900 * std::sin(time * 0.7f), 700, 2800);
+        if (intersectBox(origin, direction, first, glm::vec3(300, 300, 300), t, normal)) consider(t, normal, 2);
+
+        glm::vec3 second(-600, 500, 2200 + 700 * std::sin(time));
+        if (intersectBox(origin, direction, second, glm::vec3(200, 500, 200), t, normal)) consider(t, normal, 4);
+    }
+
+    if (object < 0)
+    {
+        shade = 0;
+        return 0;
+    }
+
+    float length = std::sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+    shade = std::abs(nearestNormal.x * direction.x + nearestNormal.y * direction.y + nearestNormal.z * direction.z) / length;
+
+    return origin.z + nearest * direction.z;
+}
+
+
+void ofProtonectSyntheticDevice::renderDepth(uint32_t sequence, libfreenect2::Frame* depth, libfreenect2::Frame* ir) const
+{
+    float time = getTime(sequence);
+    float* depthData = reinterpret_cast<float*>(depth->data);
+    float* irData = ir ? reinterpret_cast<float*>(ir->data) : nullptr;
+
+    for (std::size_t y = 0; y < DEPTH_HEIGHT; y++)
+    {
+        for (std::size_t x = 0; x < DEPTH_WIDTH; x++)
+        {
+            // The same pixel center convention as Registration::getPointXYZ().
+            glm::vec3 direction((x + 0.5f - irParams.cx) / irParams.fx,
+                                (y + 0.5f - irParams.cy) / irParams.fy,
+                                1);
+            float shade;
+            int object;
+            float z = castRay(glm::vec3(0, 0, 0), direction, time, shade, object);
+
+            std::size_t i = y * DEPTH_WIDTH + x;
+            depthData[i] = z;
+
+            if (irData)
+            {
+                // Active illumination falls off with the square of the distance.
+                float falloff = z > 0 ? (1500.0f * 1500.0f) / (z * z) : 0;
+                irData[i] = std::min(65535.0f, 400.0f + 6000.0f * shade * falloff);
+            }
+        }
+    }
+
+    for (libfreenect2::Frame* frame: { depth, ir })
+    {
+        if (frame)
+        {
+            frame->format = libfreenect2::Frame::Float;
+            frame->sequence = sequence;
+            frame->timestamp = static_cast<uint32_t>(sequence * TIMESTAMP_RATE / NOMINAL_FRAME_RATE);
+            frame->status = 0;
+        }
+    }
+}
+
+
+void ofProtonectSyntheticDevice::renderColor(uint32_t sequence, libfreenect2::Frame* color) const
+{
+    float time = getTime(sequence);
+
+    // The color camera sits next to the IR camera, see getDefaultColorCameraParams().
+    glm::vec3 origin(-colorParams.shift_m, 0, 0);
+
+    for (std::size_t by = 0; by < COLOR_HEIGHT; by += COLOR_BLOCK)
+    {
+        for (std::size_t bx = 0; bx < COLOR_WIDTH; bx += COLOR_BLOCK)
+        {
+            glm::vec3 direction((bx + COLOR_BLOCK * 0.5f - colorParams.cx) / colorParams.fx,
+                                (by + COLOR_BLOCK * 0.5f - colorParams.cy) / colorParams.fy,
+                                1);
+            float shade;
+            int object;
+            castRay(origin, direction, time, shade, object);
+
+            unsigned char bgrx[4] = { 0, 0, 0, 255 };
+
+            if (object >= 0)
+            {
+                float light = 0.25f + 0.75f * shade;
+                bgrx[0] = static_cast<unsigned char>(OBJECT_COLORS[object][2] * light);
+                bgrx[1] = static_cast<unsigned char>(OBJECT_COLORS[object][1] * light);
+                bgrx[2] = static_cast<unsigned char>(OBJECT_COLORS[object][0] * light);
+            }
+
+            for (std::size_t y = by; y < by + COLOR_BLOCK; y++)
+            {
+                unsigned char* row = color->data + (y * COLOR_WIDTH + bx) * 4;
+
+                for (std::size_t x = 0; x < COLOR_BLOCK; x++)
+                {
+                    std::memcpy(row + x * 4, bgrx, 4);
+                }
+            }
+        }
+    }
+
+    color->format = libfreenect2::Frame::BGRX;
+    color->sequence = sequence;
+    color->timestamp = static_cast<uint32_t>(sequence * TIMESTAMP_RATE / NOMINAL_FRAME_RATE);
+    color->status = 0;
+}
+
+
+libfreenect2::Freenect2Device::IrCameraParams ofProtonectSyntheticDevice::getDefaultIrCameraParams()
+{
+    IrCameraParams params;
+    params.fx = 365.5f;
+    params.fy = 365.5f;
+    params.cx = 257.5f;
+    params.cy = 209.5f;
+    params.k1 = 0;
+    params.k2 = 0;
+    params.k3 = 0;
+    params.p1 = 0;
+    params.p2 = 0;
+    return params;
+}
+
+
+libfreenect2::Freenect2Device::ColorCameraParams ofProtonectSyntheticDevice::getDefaultColorCameraParams()
+{
+    IrCameraParams ir = getDefaultIrCameraParams();
+
+    ColorCameraParams params;
+    std::memset(&params, 0, sizeof(params));
+
+    params.fx = 1081.37f;
+    params.fy = 1081.37f;
+    params.cx = 959.5f;
+    params.cy = 539.5f;
+
+    // A pure 52 mm horizontal baseline. Registration computes the color column
+    // as (wx / (fx * COLOR_Q) - shift_m / shift_d + shift_m / z) * fx + cx and
+    // the row as wy / COLOR_Q + cy, with wx and wy polynomials of the depth
+    // pixel offset from the center scaled by DEPTH_Q. The linear terms below
+    // make that a pinhole projection.
+    params.shift_d = 863;
+    params.shift_m = 52;
+
+    params.mx_x1y0 = params.fx * COLOR_Q / (DEPTH_Q * ir.fx);
+    params.mx_x0y0 = params.shift_m / params.shift_d * params.fx * COLOR_Q;
+    params.my_x0y1 = params.fy * COLOR_Q / (DEPTH_Q * ir.fy);
+
+    return params;
+}
+
+
+std::string ofProtonectSyntheticDevice::getSerialNumber()
+{
+    return "synthetic";
+}
+
+
+std::string ofProtonectSyntheticDevice::getFirmwareVersion()
+{
+    return "synthetic";
+}
+
+
+libfreenect2::Freenect2Device::ColorCameraParams ofProtonectSyntheticDevice::getColorCameraParams()
+{
+    return colorParams;
+}
+
+
+libfreenect2::Freenect2Device::IrCameraParams ofProtonectSyntheticDevice::getIrCameraParams()
+{
+    return irParams;
+}
+
+
+void ofProtonectSyntheticDevice::setColorCameraParams(const ColorCameraParams& params)
+{
+    colorParams = params;
+}
+
+
+void ofProtonectSyntheticDevice::setIrCameraParams(const IrCameraParams& params)
+{
+    irParams = params;
+}
+
+
+void ofProtonectSyntheticDevice::setConfiguration(const Config& /*config*/)
+{
+}
+
+
+void ofProtonectSyntheticDevice::setColorFrameListener(libfreenect2::FrameListener* listener)
+{
+    colorListener = listener;
+}
+
+
+void ofProtonectSyntheticDevice::setIrAndDepthFrameListener(libfreenect2::FrameListener* listener)
+{
+    irAndDepthListener = listener;
+}
+
+
+void ofProtonectSyntheticDevice::setColorAutoExposure(float /*exposureCompensation*/)
+{
+}
+
+
+void ofProtonectSyntheticDevice::setColorSemiAutoExposure(float /*pseudoExposureTimeMs*/)
+{
+}
+
+
+void ofProtonectSyntheticDevice::setColorManualExposure(float /*integrationTimeMs*/, float /*analogGain*/)
+{
+}
+
+
+void ofProtonectSyntheticDevice::setColorSetting(libfreenect2::ColorSettingCommandType /*cmd*/, uint32_t /*value*/)
+{
+}
+
+
+void ofProtonectSyntheticDevice::setColorSetting(libfreenect2::ColorSettingCommandType /*cmd*/, float /*value*/)
+{
+}
+
+
+uint32_t ofProtonectSyntheticDevice::getColorSetting(libfreenect2::ColorSettingCommandType /*cmd*/)
+{
+    return 0;
+}
+
+
+float ofProtonectSyntheticDevice::getColorSettingFloat(libfreenect2::ColorSettingCommandType /*cmd*/)
+{
+    return 0;
+}
+
+
+bool ofProtonectSyntheticDevice::start()
+{
+    return startStreams(true, true);
+}
+
+
+bool ofProtonectSyntheticDevice::startStreams(bool rgb, bool depth)
+{
+    stop();
+
+    enableRGB = rgb;
+    enableDepth = depth;
+
+    startThread();
+    return true;
+}
+
+
+bool ofProtonectSyntheticDevice::stop()
+{
+    if (isThreadRunning())
+    {
+        waitForThread(true);
+    }
+
+    return true;
+}
+
+
+bool ofProtonectSyntheticDevice::close()
+{
+    return stop();
+}
+
+
+void ofProtonectSyntheticDevice::threadedFunction()
+{
+    libfreenect2::Frame* color = nullptr;
+    libfreenect2::Frame* ir = nullptr;
+    libfreenect2::Frame* depth = nullptr;
+
+    uint32_t sequence = 0;
+    auto nextFrameTime = std::chrono::steady_clock::now();
+
+    while (isThreadRunning())
+    {
+        if (enableDepth && irAndDepthListener)
+        {
+            if (!ir) ir = new libfreenect2::Frame(DEPTH_WIDTH, DEPTH_HEIGHT, 4);
+            if (!depth) depth = new libfreenect2::Frame(DEPTH_WIDTH, DEPTH_HEIGHT, 4);
+
+            renderDepth(sequence, depth, ir);
+
+            // Like libfreenect2, only allocate again if the listener kept the frame.
+            if (irAndDepthListener->onNewFrame(libfreenect2::Frame::Ir, ir)) ir = nullptr;
+            if (irAndDepthListener->onNewFrame(libfreenect2::Frame::Depth, depth)) depth = nullptr;
+        }
+
+        if (enableRGB && colorListener)
+        {
+            if (!color) color = new libfreenect2::Frame(COLOR_WIDTH, COLOR_HEIGHT, 4);
+
+            renderColor(sequence, color);
+
+            if (colorListener->onNewFrame(libfreenect2::Frame::Color, color)) color = nullptr;
+        }
+
+        sequence++;
+
+        float fps = frameRate;
+
+        if (fps > 0)
+        {
+            nextFrameTime += std::chrono::microseconds(static_cast<int64_t>(1000000 / fps));
+            std::this_thread::sleep_until(nextFrameTime);
+        }
+        else
+        {
+            nextFrameTime = std::chrono::steady_clock::now();
+        }
+    }
+
+    delete color;
+    delete ir;
+    delete depth;
+}
@@ -0,0 +1,114 @@
+//  ofProtonectSyntheticDevice.h
+//
+//  A frame source that renders analytic scenes instead of reading a sensor.
+
+
+#pragma once
+
+
+#include "ofMain.h"
+
+#include <libfreenect2/libfreenect2.hpp>
+
+
+/// \brief A libfreenect2 device that renders a synthetic scene.
+///
+/// It behaves like a real Freenect2Device: once started it delivers 512x424
+/// float depth and IR frames and 1920x1080 BGRX color frames to the frame
+/// listeners from its own thread, and it reports fabricated camera parameters
+/// with the same layout as a Kinect v2. Open it with ofProtonect::open() or
+/// ofxKinectV2::open() to run registration, the point cloud and the threaded
+/// hand off without a sensor attached.
+///
+/// Frames only depend on their sequence number, so a run is reproducible no
+/// matter how fast it goes.
+class ofProtonectSyntheticDevice: public libfreenect2::Freenect2Device, public ofThread
+{
+public:
+    enum class Scene
+    {
+        /// A flat wall two meters away.
+        PLANE,
+        /// A room with a floor and a few spheres, one of them bouncing.
+        SPHERES,
+        /// A room with a floor and two moving boxes.
+        MOVING_BOXES
+    };
+
+    /// \param scene The scene to render.
+    /// \param frameRate Frames per second, or 0 to render as fast as possible.
+    ofProtonectSyntheticDevice(Scene scene = Scene::MOVING_BOXES, float frameRate = 30);
+    virtual ~ofProtonectSyntheticDevice();
+
+    /// \brief Change the frame rate, 0 renders as fast as possible.
+    void setFrameRate(float frameRate);
+    float getFrameRate() const;
+
+    /// \brief Render the depth and IR images of a frame.
+    /// \param sequence The frame number.
+    /// \param depth A 512x424 float frame to render into.
+    /// \param ir A 512x424 float frame to render into, may be nullptr.
+    void renderDepth(uint32_t sequence, libfreenect2::Frame* depth, libfreenect2::Frame* ir) const;
+
+    /// \brief Render the color image of a frame.
+    /// \param sequence The frame number.
+    /// \param color A 1920x1080 BGRX frame to render into.
+    void renderColor(uint32_t sequence, libfreenect2::Frame* color) const;
+
+    /// \returns typical Kinect v2 IR camera parameters, without lens distortion.
+    static IrCameraParams getDefaultIrCameraParams();
+
+    /// \returns color camera parameters that match getDefaultIrCameraParams().
+    static ColorCameraParams getDefaultColorCameraParams();
+
+    std::string getSerialNumber() override;
+    std::string getFirmwareVersion() override;
+
+    ColorCameraParams getColorCameraParams() override;
+    IrCameraParams getIrCameraParams() override;
+    void setColorCameraParams(const ColorCameraParams& params) override;
+    void setIrCameraParams(const IrCameraParams& params) override;
+    void setConfiguration(const Config& config) override;
+
+    void setColorFrameListener(libfreenect2::FrameListener* listener) override;
+    void setIrAndDepthFrameListener(libfreenect2::FrameListener* listener) override;
+
+    void setColorAutoExposure(float exposureCompensation = 0) override;
+    void setColorSemiAutoExposure(float pseudoExposureTimeMs) override;
+    void setColorManualExposure(float integrationTimeMs, float analogGain) override;
+    void setColorSetting(libfreenect2::ColorSettingCommandType cmd, uint32_t value) override;
+    void setColorSetting(libfreenect2::ColorSettingCommandType cmd, float value) override;
+    uint32_t getColorSetting(libfreenect2::ColorSettingCommandType cmd) override;
+    float getColorSettingFloat(libfreenect2::ColorSettingCommandType cmd) override;
+
+    bool start() override;
+    bool startStreams(bool rgb, bool depth) override;
+    bool stop() override;
+    bool close() override;
+
+protected:
+    void threadedFunction() override;
+
+    /// \brief Intersect a ray with the scene.
+    /// \param origin The ray origin in millimeters.
+    /// \param direction The ray direction, with a z of 1.
+    /// \param time The scene time in seconds.
+    /// \param[out] shade Lambertian shading at the hit, 0 to 1.
+    /// \param[out] object The index of the object that was hit.
+    /// \returns the z distance of the hit in millimeters, 0 if nothing was hit.
+    float castRay(const glm::vec3& origin, const glm::vec3& direction, float time, float& shade, int& object) const;
+
+    static float getTime(uint32_t sequence);
+
+    Scene scene;
+    std::atomic<float> frameRate;
+
+    IrCameraParams irParams;
+    ColorCameraParams colorParams;
+
+    libfreenect2::FrameListener* colorListener = nullptr;
+    libfreenect2::FrameListener* irAndDepthListener = nullptr;
+
+    bool enableRGB = false;
+    bool enableDepth = false;
+};
@@ -0,0 +1,148 @@
+//  ofProtonectTimings.cpp
+
+
+#include "ofProtonectTimings.h"
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+
+ofProtonectTimings::ofProtonectTimings(std::size_t _numSamples):
+    numSamples(std::max<std::size_t>(_numSamples, 1))
+{
+    for (auto& stage: samples)
+    {
+        stage.values.reset(new std::atomic<uint32_t>[numSamples]);
+    }
+
+    clear();
+}
+
+
+uint64_t ofProtonectTimings::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void ofProtonectTimings::record(Stage stage, uint64_t startTime)
+{
+    recordDuration(stage, now() - startTime);
+}
+
+
+void ofProtonectTimings::recordDuration(Stage stage, uint64_t nanoseconds)
+{
+    Samples& stageSamples = samples[static_cast<std::size_t>(stage)];
+
+    uint64_t microseconds = std::min<uint64_t>(nanoseconds / 1000, UINT32_MAX);
+    uint64_t index = stageSamples.numRecorded.load(std::memory_order_relaxed);
+
+    stageSamples.values[index % numSamples].store(static_cast<uint32_t>(microseconds), std::memory_order_relaxed);
+    stageSamples.numRecorded.store(index + 1, std::memory_order_release);
+}
+
+
+ofProtonectTimings::Summary ofProtonectTimings::getSummary(Stage stage) const
+{
+    const Samples& stageSamples = samples[static_cast<std::size_t>(stage)];
+
+    std::size_t count = std::min<uint64_t>(stageSamples.numRecorded.load(std::memory_order_acquire), numSamples);
+
+    std::vector<uint32_t> sorted(count);
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        sorted[i] = stageSamples.values[i].load(std::memory_order_relaxed);
+    }
+
+    Summary summary;
+
+    if (sorted.empty())
+    {
+        return summary;
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+
+    double total = 0;
+
+    for (uint32_t value: sorted)
+    {
+        total += value;
+    }
+
+    auto percentile = [&sorted](double p)
+    {
+        // Nearest rank.
+        std::size_t rank = static_cast<std::size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1];
+    };
+
+    summary.numSamples = sorted.size();
+    summary.mean = total / sorted.size();
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.max = sorted.back();
+
+    return summary;
+}
+
+
+void ofProtonectTimings::clear()
+{
+    for (auto& stage: samples)
+    {
+        stage.numRecorded.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+std::string ofProtonectTimings::toString() const
+{
+    std::stringstream ss;
+
+    for (std::size_t i = 0; i < static_cast<std::size_t>(Stage::NUM_STAGES); i++)
+    {
+        Stage stage = static_cast<Stage>(i);
+        Summary summary = getSummary(stage);
+
+        if (summary.numSamples == 0)
+        {
+            continue;
+        }
+
+        ss << std::left << std::setw(16) << getStageName(stage) << std::right
+           << " p50 " << std::setw(7) << summary.p50
+           << " p95 " << std::setw(7) << summary.p95
+           << " p99 " << std::setw(7) << summary.p99
+           << " max " << std::setw(7) << summary.max
+           << " us (" << summary.numSamples << " samples)" << std::endl;
+    }
+
+    return ss.str();
+}
+
+
+std::string ofProtonectTimings::getStageName(Stage stage)
+{
+    switch (stage)
+    {
+        case Stage::WAIT_FOR_FRAME: return "wait for frame";
+        case Stage::REGISTRATION: return "registration";
+        case Stage::PIXELS: return "pixels";
+        case Stage::POINT_CLOUD: return "point cloud";
+        case Stage::FACES: return "faces";
+        case Stage::HANDOFF: return "handoff";
+        case Stage::CONVERSION: return "conversion";
+        case Stage::NUM_STAGES: break;
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,88 @@
+//  ofProtonectTimings.h
+//
+//  Always-on per stage latency measurements of the Kinect pipeline.
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+/// \brief Records how long each pipeline stage takes for one device.
+///
+/// Every stage keeps the most recent samples in a fixed size ring buffer.
+/// Recording a sample is two reads of the monotonic clock plus two relaxed
+/// atomic operations, so the timers stay enabled all the time. Each stage must
+/// only be recorded from one thread, summaries can be queried from any thread.
+class ofProtonectTimings
+{
+public:
+    enum class Stage
+    {
+        /// Blocked waiting for libfreenect2 to deliver frames.
+        WAIT_FOR_FRAME,
+        /// Registration::apply() or undistorting the depth.
+        REGISTRATION,
+        /// Filling the FrameSet pixels from the decoded frames.
+        PIXELS,
+        /// Building the point cloud vertices.
+        POINT_CLOUD,
+        /// Building the point cloud faces.
+        FACES,
+        /// Publishing a FrameSet to the app thread.
+        HANDOFF,
+        /// Converting depth and IR to 8 bit.
+        CONVERSION,
+        NUM_STAGES
+    };
+
+    /// \brief Statistics over the samples currently held for a stage.
+    ///
+    /// All times are in microseconds.
+    struct Summary
+    {
+        std::size_t numSamples = 0;
+        double mean = 0;
+        uint32_t p50 = 0;
+        uint32_t p95 = 0;
+        uint32_t p99 = 0;
+        uint32_t max = 0;
+    };
+
+    /// \param numSamples The number of samples kept per stage.
+    ofProtonectTimings(std::size_t numSamples = 1024);
+
+    /// \returns the current time of the monotonic clock in nanoseconds.
+    static uint64_t now();
+
+    /// \brief Record a sample that started at startTime, as returned by now().
+    void record(Stage stage, uint64_t startTime);
+
+    /// \brief Record a sample of the given length.
+    void recordDuration(Stage stage, uint64_t nanoseconds);
+
+    /// \returns the latency summary of a stage.
+    Summary getSummary(Stage stage) const;
+
+    /// \brief Forget all samples.
+    void clear();
+
+    /// \returns a human readable report of all stages that have samples.
+    std::string toString() const;
+
+    static std::string getStageName(Stage stage);
+
+private:
+    struct Samples
+    {
+        std::unique_ptr<std::atomic<uint32_t>[]> values;
+        std::atomic<uint64_t> numRecorded;
+    };
+
+    std::size_t numSamples;
+    Samples samples[static_cast<std::size_t>(Stage::NUM_STAGES)];
+};
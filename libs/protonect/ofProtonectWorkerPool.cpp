@@ -0,0 +1,132 @@
+//  ofProtonectWorkerPool.cpp
+
+
+#include "ofProtonectWorkerPool.h"
+
+
+#include <algorithm>
+
+
+ofProtonectWorkerPool::ofProtonectWorkerPool(std::size_t numWorkers)
+{
+    for (std::size_t i = 0; i < numWorkers; i++)
+    {
+        workers.emplace_back(&ofProtonectWorkerPool::threadedFunction, this);
+    }
+}
+
+
+ofProtonectWorkerPool::~ofProtonectWorkerPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        running = false;
+    }
+
+    condition.notify_all();
+
+    for (std::thread& worker: workers)
+    {
+        worker.join();
+    }
+}
+
+
+void ofProtonectWorkerPool::parallelFor(std::size_t numTasks, const std::function<void(std::size_t)>& task)
+{
+    if (workers.empty() || numTasks <= 1)
+    {
+        for (std::size_t i = 0; i < numTasks; i++)
+        {
+            task(i);
+        }
+
+        return;
+    }
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->task = &task;
+    job->numTasks = numTasks;
+    job->nextTask = 0;
+    job->numDone = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+
+    condition.notify_all();
+
+    work(*job);
+
+    // Tasks claimed by workers may still be running.
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->condition.wait(lock, [&job]()
+    {
+        return job->numDone.load() == job->numTasks;
+    });
+}
+
+
+std::size_t ofProtonectWorkerPool::getConcurrency() const
+{
+    return workers.size() + 1;
+}
+
+
+ofProtonectWorkerPool& ofProtonectWorkerPool::getShared()
+{
+    static ofProtonectWorkerPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    return pool;
+}
+
+
+void ofProtonectWorkerPool::work(Job& job)
+{
+    std::size_t i;
+
+    while ((i = job.nextTask.fetch_add(1)) < job.numTasks)
+    {
+        (*job.task)(i);
+
+        if (job.numDone.fetch_add(1) + 1 == job.numTasks)
+        {
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.condition.notify_all();
+        }
+    }
+}
+
+
+void ofProtonectWorkerPool::threadedFunction()
+{
+    while (true)
+    {
+        std::shared_ptr<Job> job;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            condition.wait(lock, [this]()
+            {
+                return !jobs.empty() || !running;
+            });
+
+            if (!running)
+            {
+                return;
+            }
+
+            job = jobs.front();
+
+            // Once every task is claimed nobody needs to look at it anymore.
+            if (job->nextTask.load() >= job->numTasks)
+            {
+                jobs.pop_front();
+                continue;
+            }
+        }
+
+        work(*job);
+    }
+}
@@ -0,0 +1,70 @@
+//  ofProtonectWorkerPool.h
+//
+//  A pool of threads that splits per frame work of all devices.
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// \brief Runs the tasks of a parallel loop on a fixed set of threads.
+///
+/// Any number of threads may call parallelFor() at once, e.g. the threads of
+/// several devices. Each call queues a job whose tasks are claimed one by one
+/// by the workers and the calling thread, which keeps working on its own job
+/// instead of waiting idle. Tasks are claimed dynamically, so uneven tasks
+/// still balance out.
+class ofProtonectWorkerPool
+{
+public:
+    /// \param numWorkers The number of threads, besides the calling ones.
+    ofProtonectWorkerPool(std::size_t numWorkers);
+    ~ofProtonectWorkerPool();
+
+    /// \brief Run task(0) ... task(numTasks - 1) and wait until all returned.
+    ///
+    /// Tasks run concurrently and in no particular order.
+    void parallelFor(std::size_t numTasks, const std::function<void(std::size_t)>& task);
+
+    /// \returns the number of threads a parallelFor() can run on at once.
+    std::size_t getConcurrency() const;
+
+    /// \returns the pool shared by all devices, with a worker per additional core.
+    static ofProtonectWorkerPool& getShared();
+
+private:
+    struct Job
+    {
+        const std::function<void(std::size_t)>* task = nullptr;
+        std::size_t numTasks = 0;
+        std::atomic<std::size_t> nextTask;
+        std::atomic<std::size_t> numDone;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+
+    /// \brief Run tasks of a job until none is left to claim.
+    static void work(Job& job);
+
+    void threadedFunction();
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::shared_ptr<Job>> jobs;
+    bool running = true;
+
+    ofProtonectWorkerPool(const ofProtonectWorkerPool&) = delete;
+    ofProtonectWorkerPool& operator=(const ofProtonectWorkerPool&) = delete;
+};
@@ -9,7 +9,8 @@
 #include "ofxKinectV2.h"
 
 
-ofxKinectV2::ofxKinectV2()
+ofxKinectV2::ofxKinectV2():
+    frameSet(std::make_shared<ofProtonect::FrameSet>())
 {
     //set default distance range to 50cm - 600cm
     params.add(minDistance.set("minDistance", 500, 0, 12000));
@@ -38,7 +39,13 @@ ofxKinectV2::ofxKinectV2()
     
     params.add(facesMaxLength.set("Point cloud faces length", 100.0, 1.0, 500.0));
     params.add(steps.set("Point clooud tex steps", 1, 1, 10));
-    
+
+    // Idle FrameSets would keep their decoded frames, which count towards
+    // the frame pool size, and starve the listener.
+    framePool.setOnRelease([](ofProtonect::FrameSet& frameSet)
+    {
+        frameSet.releaseFrames();
+    });
 }
 
 
@@ -101,7 +108,7 @@ bool ofxKinectV2::open(int deviceId, ofProtonect::PacketPipelineType packetPipel
 
     string serial = devices[deviceId].serial;
     
-    return open(serial , packetPipelineType, processingDevice, initRGB, initDepth, registerImages, usePointCloud, pointCloudHasFaces, pointCloudHasFaces);
+    return open(serial , packetPipelineType, processingDevice, initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces, pointCloudTexCoords);
 }
 
 bool ofxKinectV2::open(const std::string& serial, ofProtonect::PacketPipelineType packetPipelineType,  int processingDevice, bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces, bool pointCloudTexCoords)
@@ -111,9 +118,12 @@ bool ofxKinectV2::open(const std::string& serial, ofProtonect::PacketPipelineTyp
     params.setName("kinectV2 " + serial);
     
     bNewFrame  = false;
-    bNewBuffer = false;
     bOpened    = false;
+    frameSets.reset();
     
+    // Set before opening, so only these streams are started.
+    setStreamSettings(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces);
+
     int retVal = protonect.open(serial,packetPipelineType,processingDevice);
     
     if (retVal != 0)
@@ -121,6 +131,97 @@ bool ofxKinectV2::open(const std::string& serial, ofProtonect::PacketPipelineTyp
         return false;
     }
     
+    return startKinect(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces, pointCloudTexCoords);
+}
+
+bool ofxKinectV2::open(libfreenect2::Freenect2Device* frameSource, bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces, bool pointCloudTexCoords)
+{
+    close();
+
+    bNewFrame  = false;
+    bOpened    = false;
+    frameSets.reset();
+
+    if (!frameSource)
+    {
+        ofLogError("ofxKinectV2::open") << "no frame source";
+        return false;
+    }
+
+    params.setName("kinectV2 " + frameSource->getSerialNumber());
+
+    setStreamSettings(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces);
+
+    if (protonect.open(frameSource) != 0)
+    {
+        return false;
+    }
+
+    return startKinect(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces, pointCloudTexCoords);
+}
+
+bool ofxKinectV2::openReplay(const std::string& directory, ofProtonect::PacketPipelineType packetPipelineType, ofProtonect::ReplayMode mode, int processingDevice, bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces, bool pointCloudTexCoords)
+{
+    close();
+
+    bNewFrame  = false;
+    bOpened    = false;
+    frameSets.reset();
+
+    params.setName("kinectV2 replay " + ofFilePath::getBaseName(directory));
+
+    setStreamSettings(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces);
+
+    if (protonect.openReplay(directory, packetPipelineType, mode, processingDevice) != 0)
+    {
+        return false;
+    }
+
+    return startKinect(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces, pointCloudTexCoords);
+}
+
+bool ofxKinectV2::openFrameFile(const std::string& path, ofProtonect::ReplayMode mode, bool loop, bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces, bool pointCloudTexCoords)
+{
+    close();
+
+    bNewFrame  = false;
+    bOpened    = false;
+    frameSets.reset();
+
+    params.setName("kinectV2 " + ofFilePath::getFileName(path));
+
+    setStreamSettings(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces);
+
+    if (protonect.openFrameFile(path, mode, loop) != 0)
+    {
+        return false;
+    }
+
+    return startKinect(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces, pointCloudTexCoords);
+}
+
+ofProtonectFrameFileReader* ofxKinectV2::getFrameFile()
+{
+    return protonect.getFrameFile();
+}
+
+bool ofxKinectV2::startRecording(const std::string& path, bool recordPointCloud)
+{
+    return protonect.startRecording(path, recordPointCloud);
+}
+
+void ofxKinectV2::stopRecording()
+{
+    protonect.stopRecording();
+}
+
+bool ofxKinectV2::isRecording() const
+{
+    return protonect.isRecording();
+}
+
+bool ofxKinectV2::startKinect(bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces, bool pointCloudTexCoords)
+{
     lastFrameNo = -1;
 
     bOpened = true;
@@ -131,45 +232,36 @@ bool ofxKinectV2::open(const std::string& serial, ofProtonect::PacketPipelineTyp
     bRegisterImages = registerImages;
     bPointCloudFilled = pointCloudHasFaces;
     bEnableRGB = initRGB;
+    bEnableIr = initIr;
     bEnableDepth = initDepth;
     bPointCloudTexCoords = pointCloudTexCoords;
     
-    setUseRgb(initRGB);
-    setUseDepth(initDepth);
-    setUseRegisterImages(registerImages);
-    setUsePointCloud(usePointCloud);
+    setStreamSettings(initRGB, initIr, initDepth, registerImages, usePointCloud, pointCloudHasFaces);
     setIsPointCloudFilled(pointCloudHasFaces);
     setUseTexCoords(pointCloudTexCoords);
 	setTransformPointCloud(true);
-	
-    
-    if(pointCloudHasFaces){
-        pointCloud.setMode(OF_PRIMITIVE_TRIANGLES);
-        setUseRgb(true);
-        setUseDepth(true);
-        setUseRegisterImages(true);
-        setUsePointCloud(true);
-    }
-    else{
-        pointCloud.setMode(OF_PRIMITIVE_POINTS);
-        setUseRgb(true);
-        setUseDepth(true);
-        setUseRegisterImages(true);
-    }
-    
-    if (usePointCloud) {
-        setUseRgb(true);
-        setUseDepth(true);
-        setUseRegisterImages(true);
-    }
-    if (registerImages) {
-        setUseRgb(true);
-        setUseDepth(true);
-    }
+
     startThread();
     return true;
 }
 
+void ofxKinectV2::setStreamSettings(bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces)
+{
+    // Only the streams the outputs need: the faces are made from the point
+    // cloud, which is colored or textured with the registered color unless
+    // it is geometry only, and registering needs color and depth.
+    // ofProtonect works out per frame which processing steps the enabled
+    // outputs depend on.
+    const bool points = usePointCloud || pointCloudHasFaces;
+    const bool registration = registerImages || (points && !protonect.getPointCloudGeometryOnly());
+
+    protonect.setStreams(initRGB || registration, initDepth || registration);
+    // IR always comes with the depth stream, this only drops its output.
+    protonect.setUseIr(initIr);
+    setUseRegisterImages(registration);
+    setUsePointCloud(points);
+}
+
 
 
 
@@ -177,51 +269,26 @@ void ofxKinectV2::threadedFunction()
 {
     while (isThreadRunning())
     {
-        protonect.updateKinect(pixelsBack,
-                               registeredPixelsBack,
-                               rawDepthPixelsBack,
-                               rawIRPixelsBack,
-                               distancePixelsBack, pcVertsBack, pcColorsBack,pcIndicesBack, pcTexCoordsBack,steps,minDistance,maxDistance,facesMaxLength);
-        if (getUseRgb()) {
-            pixelsFront.swap(pixelsBack);
-        }
-        
-        
-        if(getUseRegisterImages()){
-            registeredPixelsFront.swap(registeredPixelsBack);
-        }
-        if(getUseDepth()){
-            rawDepthPixelsFront.swap(rawDepthPixelsBack);
-            distancePixelsFront.swap(distancePixelsBack);
-        }
-        if(getUseIr()){
-            rawIRPixelsFront.swap(rawIRPixelsBack);
-        }
-        
-        if(getUsePointCloud()){
-            pcVertsFront.swap(pcVertsBack);
-            if (getUseTexCoords()) {
-                pcTexCoordsFront.swap(pcTexCoordsBack);
-                pointCloud.getTexCoords().swap(pcTexCoordsFront);
+        std::shared_ptr<ofProtonect::FrameSet> nextFrameSet = framePool.acquire();
 
-            }
-            else{
-                pcColorsFront.swap(pcColorsBack);
-                pointCloud.getColors().swap(pcColorsFront);
-            }
-            
-            pointCloud.getVertices().swap(pcVertsFront);
-            
-        }
+        if (protonect.updateKinect(*nextFrameSet, steps, minDistance, maxDistance, facesMaxLength))
+        {
+            uint64_t startTime = ofProtonectTimings::now();
 
-        if (getIsPointCloudFilled()) {
-            pointCloud.getIndices().swap(pcIndicesFront);
-            pcIndicesFront.swap(pcIndicesBack);
+            frameSets.getWriteBuffer() = std::move(nextFrameSet);
+            frameSets.publish();
+
+            // Drop the frame we got back right away so its buffers can be reused.
+            frameSets.getWriteBuffer().reset();
+
+            protonect.getTimings().record(ofProtonectTimings::Stage::HANDOFF, startTime);
+        }
+        else if (protonect.hasFailed())
+        {
+            // The device is closed by close() on the app thread, which may still use it.
+            ofLogError("ofxKinectV2::threadedFunction") << "the device failed, no more frames until it is opened again";
+            return;
         }
-        
-		lock();
-        bNewBuffer = true;
-        unlock();
     }
 }
 
@@ -234,89 +301,14 @@ void ofxKinectV2::update()
         lastFrameNo = ofGetFrameNum();
     }
     
-    if (bNewBuffer)
+    if (frameSets.acquire())
     {
-        lock();
-            if(getUseRgb()){
-                pixels = pixelsFront;
-            }
-        
-            if(getUseRegisterImages()){
-                registeredPixels = registeredPixelsFront;
-            }
-        
-            if(getUseDepth()){
-                rawDepthPixels = rawDepthPixelsFront;
-            }
-        
-            if(getUseIr()){
-                rawIRPixels = rawIRPixelsFront;
-            }
-        
-            if(getUsePointCloud()){
-                pcVerts = pcVertsFront;
-                if (getUseTexCoords()) {
-                    pcTexCoords = pcTexCoordsFront;
-                }
-                else{
-                    pcColors = pcColorsFront;
-                }
-                
-                
-            }
-			
-        
-            if (getIsPointCloudFilled()) {
-                pcIndices = pcIndicesFront;
-            }
-			
-            bNewBuffer = false;
-        unlock();
-        if(getUseDepth()){
-            // TODO: This is inefficient and we should be able to turn it off or
-            // draw it directly with a shader.
-            if (rawDepthPixels.size() > 0)
-            {
-                if (depthPixels.getWidth() != rawDepthPixels.getWidth())
-                {
-                    depthPixels.allocate(rawDepthPixels.getWidth(), rawDepthPixels.getHeight(), 1);
-                }
-            
-                float* pixelsF = rawDepthPixels.getData();
-                unsigned char * pixelsC = depthPixels.getData();
-                    
-                for (std::size_t i = 0; i < depthPixels.size(); i++)
-                {
-                    pixelsC[i] = ofMap(pixelsF[i], minDistance, maxDistance, 255, 0, true);
-                
-                    if (pixelsC[i] == 255)
-                    {
-                        pixelsC[i] = 0;
-                    }
-                }
-            }
-        }
-        
-        if (getUseIr()) {
-            // TODO: This is inefficient and we should be able to turn it off or
-            // draw it directly with a shader.
-            if (rawIRPixels.size() > 0)
-            {
-                if (irPixels.getWidth() != rawIRPixels.getWidth())
-                {
-                    irPixels.allocate(rawIRPixels.getWidth(), rawIRPixels.getHeight(), 1);
-                }
-                
-                float* pixelsF = rawIRPixels.getData();
-                unsigned char * pixelsC = irPixels.getData();
-                
-                for (std::size_t i = 0; i < irPixels.size(); i++)
-                {
-                    pixelsC[i] = ofMap(pixelsF[i], 0, 4500, 0, 255, true);
-                }
-            }
-        }
-        
+        frameSet = std::move(frameSets.getReadBuffer());
+
+        // The 8 bit images of the new frame are converted on demand.
+        depthPixelsValid = false;
+        irPixelsValid = false;
+
         bNewFrame = true;
     }
 }
@@ -326,6 +318,11 @@ bool ofxKinectV2::isFrameNew() const
     return bNewFrame; 
 }
 
+bool ofxKinectV2::hasFailed() const
+{
+    return protonect.hasFailed();
+}
+
 ofPixels ofxKinectV2::getRgbPixels()
 {
     return getPixels();
@@ -333,31 +330,91 @@ ofPixels ofxKinectV2::getRgbPixels()
 
 const ofPixels& ofxKinectV2::getPixels() const
 {
-    return pixels;
+    return frameSet->pixels;
 }
 
 const ofPixels& ofxKinectV2::getRegisteredPixels() const
 {
-    return registeredPixels;
+    protonect.requestOutput(ofProtonect::Output::REGISTERED);
+    return frameSet->registeredPixels;
 }
 
 const ofFloatPixels& ofxKinectV2::getRawDepthPixels() const
 {
-    return rawDepthPixels;
+    return frameSet->rawDepthPixels;
 }
 
 const ofPixels& ofxKinectV2::getDepthPixels() const
 {
+    // Converted on the processing thread from the next frame on.
+    protonect.requestOutput(ofProtonect::Output::DEPTH_PIXELS);
+
+    const ofProtonect::FrameSet& frame = *frameSet;
+
+    if (frame.depthPixels.isAllocated()
+        && frame.depthPixelsMinDistance == minDistance.get()
+        && frame.depthPixelsMaxDistance == maxDistance.get())
+    {
+        return frame.depthPixels;
+    }
+
+    // Not converted yet, or the range changed since, convert once per frame and range.
+    if (!depthPixelsValid || depthPixelsMinDistance != minDistance.get() || depthPixelsMaxDistance != maxDistance.get())
+    {
+        const ofFloatPixels& rawDepthPixels = frame.rawDepthPixels;
+
+        if (rawDepthPixels.size() > 0)
+        {
+            depthPixels.allocate(rawDepthPixels.getWidth(), rawDepthPixels.getHeight(), 1);
+            ofProtonectImageConversion::convertDepth(rawDepthPixels.getData(), rawDepthPixels.size(), minDistance, maxDistance, depthPixels.getData());
+        }
+        else
+        {
+            depthPixels.clear();
+        }
+
+        depthPixelsValid = true;
+        depthPixelsMinDistance = minDistance;
+        depthPixelsMaxDistance = maxDistance;
+    }
+
     return depthPixels;
 }
 
 const ofFloatPixels& ofxKinectV2::getRawIRPixels() const
 {
-    return rawIRPixels;
+    return frameSet->rawIRPixels;
 }
 
 const ofPixels& ofxKinectV2::getIRPixels() const
 {
+    // Converted on the processing thread from the next frame on.
+    protonect.requestOutput(ofProtonect::Output::IR_PIXELS);
+
+    const ofProtonect::FrameSet& frame = *frameSet;
+
+    if (frame.irPixels.isAllocated())
+    {
+        return frame.irPixels;
+    }
+
+    if (!irPixelsValid)
+    {
+        const ofFloatPixels& rawIRPixels = frame.rawIRPixels;
+
+        if (rawIRPixels.size() > 0)
+        {
+            irPixels.allocate(rawIRPixels.getWidth(), rawIRPixels.getHeight(), 1);
+            ofProtonectImageConversion::convertIr(rawIRPixels.getData(), rawIRPixels.size(), ofProtonect::IR_PIXELS_MAX_VALUE, irPixels.getData());
+        }
+        else
+        {
+            irPixels.clear();
+        }
+
+        irPixelsValid = true;
+    }
+
     return irPixels;
 }
 
@@ -372,7 +429,108 @@ void ofxKinectV2::setPointCloudAlpha(int alpha)
 
 const ofVboMesh& ofxKinectV2::getPointCloud() const
 {
-	return pointCloud;
+	protonect.requestOutput(ofProtonect::Output::POINT_CLOUD);
+	return frameSet->pointCloud;
+}
+
+const ofFloatPixels& ofxKinectV2::getDistancePixels() const
+{
+    protonect.requestOutput(ofProtonect::Output::DISTANCE);
+    return frameSet->distancePixels;
+}
+
+const ofFloatPixels& ofxKinectV2::getOrganizedPointCloud() const
+{
+    protonect.requestOutput(ofProtonect::Output::ORGANIZED_POINT_CLOUD);
+    return frameSet->organizedPointCloud;
+}
+
+ofxKinectV2::FrameSetHandle ofxKinectV2::getFrameSet() const
+{
+    return frameSet;
+}
+
+ofxKinectV2::FrameLease<ofPixels> ofxKinectV2::leasePixels() const
+{
+    return FrameLease<ofPixels>(frameSet, &frameSet->pixels);
+}
+
+ofxKinectV2::FrameLease<ofPixels> ofxKinectV2::leaseRegisteredPixels() const
+{
+    protonect.requestOutput(ofProtonect::Output::REGISTERED);
+    return FrameLease<ofPixels>(frameSet, &frameSet->registeredPixels);
+}
+
+ofxKinectV2::FrameLease<ofFloatPixels> ofxKinectV2::leaseRawDepthPixels() const
+{
+    return FrameLease<ofFloatPixels>(frameSet, &frameSet->rawDepthPixels);
+}
+
+ofxKinectV2::FrameLease<ofFloatPixels> ofxKinectV2::leaseRawIRPixels() const
+{
+    return FrameLease<ofFloatPixels>(frameSet, &frameSet->rawIRPixels);
+}
+
+ofxKinectV2::FrameLease<ofVboMesh> ofxKinectV2::leasePointCloud() const
+{
+    protonect.requestOutput(ofProtonect::Output::POINT_CLOUD);
+    return FrameLease<ofVboMesh>(frameSet, &frameSet->pointCloud);
+}
+
+ofxKinectV2::FrameLease<ofFloatPixels> ofxKinectV2::leaseOrganizedPointCloud() const
+{
+    protonect.requestOutput(ofProtonect::Output::ORGANIZED_POINT_CLOUD);
+    return FrameLease<ofFloatPixels>(frameSet, &frameSet->organizedPointCloud);
+}
+
+const ofProtonectTimings& ofxKinectV2::getTimings() const
+{
+    return protonect.getTimings();
+}
+
+uint64_t ofxKinectV2::getNumDroppedFrames() const
+{
+    return protonect.getNumDroppedFrames();
+}
+
+void ofxKinectV2::setFramePoolSize(std::size_t size)
+{
+    protonect.setFramePoolSize(size);
+}
+
+void ofxKinectV2::setStreamMode(ofProtonect::StreamMode mode)
+{
+    protonect.setStreamMode(mode);
+}
+
+void ofxKinectV2::setOrganizedPointCloud(ofProtonect::OrganizedPointCloud mode)
+{
+    protonect.setOrganizedPointCloud(mode);
+}
+
+void ofxKinectV2::setPointCloudDecimation(ofProtonectPointCloudKernel::Decimation decimation)
+{
+    protonect.setPointCloudDecimation(decimation);
+}
+
+void ofxKinectV2::setCompactPointCloud(bool compact)
+{
+    protonect.setCompactPointCloud(compact);
+}
+
+void ofxKinectV2::setPointCloudGeometryOnly(bool geometryOnly)
+{
+    protonect.setPointCloudGeometryOnly(geometryOnly);
+}
+
+void ofxKinectV2::setDemandDriven(bool demandDriven, uint64_t numFrames)
+{
+    protonect.setDemandDriven(demandDriven, numFrames);
+}
+
+void ofxKinectV2::requestOutput(ofProtonect::Output output)
+{
+    protonect.requestOutput(output);
 }
 
 void ofxKinectV2::setPointCloudTransformationMatrix(ofMatrix4x4 _mat)
@@ -382,20 +540,45 @@ void ofxKinectV2::setPointCloudTransformationMatrix(ofMatrix4x4 _mat)
 
 float ofxKinectV2::getDistanceAt(std::size_t x, std::size_t y) const
 {
-    return glm::distance(glm::vec3(0, 0, 0), getWorldCoordinateAt(x, y));
+    const ofFloatPixels& distancePixels = frameSet->distancePixels;
+    float distance = 0;
+
+    if (x < distancePixels.getWidth() && y < distancePixels.getHeight())
+    {
+        distance = distancePixels.getData()[y * distancePixels.getWidth() + x];
+    }
+    else
+    {
+        // A single pixel doesn't need the whole distance image.
+        protonect.requestOutput(ofProtonect::Output::UNDISTORTED);
+
+        const libfreenect2::Frame* undistorted = frameSet->undistortedValid ? frameSet->undistorted.get() : nullptr;
+
+        if (protonect.pointCloudKernel.isSetup() && undistorted)
+        {
+            distance = protonect.pointCloudKernel.computeDistance(reinterpret_cast<const float*>(undistorted->data), x, y);
+        }
+    }
+
+    // Same units and invalid value as computing it from getPointXYZ().
+    return distance > 0 ? distance / 1000.0f : std::numeric_limits<float>::quiet_NaN();
 }
 
 glm::vec3 ofxKinectV2::getWorldCoordinateAt(std::size_t x, std::size_t y) const
 {
     glm::vec3 position;
     
-    if (protonect.registration && protonect.undistorted)
+    protonect.requestOutput(ofProtonect::Output::UNDISTORTED);
+
+    const libfreenect2::Frame* undistorted = frameSet->undistortedValid ? frameSet->undistorted.get() : nullptr;
+
+    if (protonect.pointCloudKernel.isSetup() && undistorted)
     {
-//        std::cout << x << ", " << protonect.undistorted->width << std::endl;
-//        std::cout << y << ", " << protonect.undistorted->height << std::endl;
-//        
-        if (x < protonect.undistorted->width && y < protonect.undistorted->height)
-            protonect.registration->getPointXYZ(protonect.undistorted, y, x, position.x, position.y, position.z);
+        if (x < undistorted->width && y < undistorted->height)
+        {
+            const glm::ivec2 pixel(static_cast<int>(x), static_cast<int>(y));
+            getWorldCoordinatesAt(frameSet, &pixel, 1, &position);
+        }
         else ofLogWarning("ofxKinectV2::getWorldCoordinateAt") << "Invalid x, y coordinates.";
 
     }
@@ -404,6 +587,68 @@ glm::vec3 ofxKinectV2::getWorldCoordinateAt(std::size_t x, std::size_t y) const
     return position;
 }
 
+bool ofxKinectV2::getWorldCoordinatesAt(const glm::ivec2* pixels, std::size_t numPixels, glm::vec3* coordinates) const
+{
+    return getWorldCoordinatesAt(frameSet, pixels, numPixels, coordinates);
+}
+
+bool ofxKinectV2::getWorldCoordinatesAt(const std::vector<glm::ivec2>& pixels, std::vector<glm::vec3>& coordinates) const
+{
+    coordinates.resize(pixels.size());
+    return getWorldCoordinatesAt(frameSet, pixels.data(), pixels.size(), coordinates.data());
+}
+
+bool ofxKinectV2::getWorldCoordinatesAt(const ofPixels& mask, std::vector<glm::vec3>& coordinates, std::vector<glm::ivec2>* pixels) const
+{
+    coordinates.clear();
+
+    protonect.requestOutput(ofProtonect::Output::UNDISTORTED);
+
+    const libfreenect2::Frame* undistorted = frameSet->undistortedValid ? frameSet->undistorted.get() : nullptr;
+
+    if (!undistorted || mask.getWidth() != undistorted->width || mask.getHeight() != undistorted->height)
+    {
+        return false;
+    }
+
+    std::vector<glm::ivec2> selected;
+    std::vector<glm::ivec2>& positions = pixels ? *pixels : selected;
+    positions.clear();
+
+    const unsigned char* maskData = mask.getData();
+    const std::size_t channels = mask.getNumChannels();
+
+    for (std::size_t y = 0; y < mask.getHeight(); y++)
+    {
+        for (std::size_t x = 0; x < mask.getWidth(); x++, maskData += channels)
+        {
+            if (*maskData)
+            {
+                positions.push_back(glm::ivec2(static_cast<int>(x), static_cast<int>(y)));
+            }
+        }
+    }
+
+    coordinates.resize(positions.size());
+    return getWorldCoordinatesAt(frameSet, positions.data(), positions.size(), coordinates.data());
+}
+
+bool ofxKinectV2::getWorldCoordinatesAt(const FrameSetHandle& frame, const glm::ivec2* pixels, std::size_t numPixels, glm::vec3* coordinates) const
+{
+    protonect.requestOutput(ofProtonect::Output::UNDISTORTED);
+
+    const libfreenect2::Frame* undistorted = frame && frame->undistortedValid ? frame->undistorted.get() : nullptr;
+
+    // The rays only change when a device is opened, which happens on this thread.
+    if (!protonect.pointCloudKernel.isSetup() || !undistorted)
+    {
+        return false;
+    }
+
+    protonect.pointCloudKernel.computeCameraPoints(reinterpret_cast<const float*>(undistorted->data), pixels, numPixels, coordinates);
+    return true;
+}
+
 void ofxKinectV2::setUsePointCloud(bool _usePointCloud){
     protonect.setUsePointCloud(_usePointCloud);
 }
@@ -477,21 +722,21 @@ bool ofxKinectV2::getTransformPointCloud()
 void ofxKinectV2::setAutoExposureCallback(bool & auto_exposure){
     if(auto_exposure){
         autoExposure = true;
-        protonect.dev->setColorAutoExposure(0);
+        protonect.setColorAutoExposure(0);
     }
 }
 
 
 
 void ofxKinectV2::setIntegrationTimeCallback(float & integration_time_ms){
-    protonect.dev->setColorManualExposure(integration_time_ms, analogueGain);
+    protonect.setColorManualExposure(integration_time_ms, analogueGain);
     autoExposure = false;
 }
 
 void ofxKinectV2::setAnalogueGainCallback(float & analog_gain){
 
-    protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
-    protonect.dev->setColorManualExposure(expIntegrationTime, analog_gain);
+    protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
+    protonect.setColorManualExposure(expIntegrationTime, analog_gain);
     autoExposure = false;
 }
 
@@ -499,12 +744,12 @@ void ofxKinectV2::setAnalogueGainCallback(float & analog_gain){
 
 void ofxKinectV2::setAutoWhiteBalanceCallback(bool & auto_white_balance){
     if(auto_white_balance == true){
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(1));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(1));
     }
     else{
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
     }
     
 }
@@ -512,38 +757,64 @@ void ofxKinectV2::setAutoWhiteBalanceCallback(bool & auto_white_balance){
 void ofxKinectV2::setRedGainCallback(float & red_gain){
     if(autoWhiteBalance){
         autoWhiteBalance = false;
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
     }
-    protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_RED_CHANNEL_GAIN, red_gain);
+    protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_RED_CHANNEL_GAIN, red_gain);
     
 }
 
 void ofxKinectV2::setGreenGainCallback(float & green_gain){
     if(autoWhiteBalance){
         autoWhiteBalance = false;
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
     }
-    protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_GREEN_CHANNEL_GAIN, green_gain);
+    protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_GREEN_CHANNEL_GAIN, green_gain);
     
 }
 
 void ofxKinectV2::setBlueGainCallback(float & blue_gain){
     if(autoWhiteBalance){
         autoWhiteBalance = false;
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
-        protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_ACS, uint32_t(0));
+        protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_WHITE_BALANCE_MODE, uint32_t(3));
     }
-    protonect.dev->setColorSetting(libfreenect2::COLOR_SETTING_SET_BLUE_CHANNEL_GAIN, blue_gain);
+    protonect.setColorSetting(libfreenect2::COLOR_SETTING_SET_BLUE_CHANNEL_GAIN, blue_gain);
 }
 
 void ofxKinectV2::close()
 {
     if (bOpened)
     {
-        waitForThread(true);
+        // Wake the thread up if it waits for a frame that may never come.
+        stopThread();
+        protonect.cancelWait();
+        waitForThread(false);
+
         protonect.closeKinect();
         bOpened = false;
     }
 }
+
+void ofxKinectV2::closeAll(const std::vector<ofxKinectV2*>& kinects)
+{
+    // Stopping the devices takes a while, stop them all at once.
+    std::vector<std::thread> closers;
+
+    for (ofxKinectV2* kinect: kinects)
+    {
+        if (kinect)
+        {
+            closers.emplace_back([kinect]()
+            {
+                kinect->close();
+            });
+        }
+    }
+
+    for (std::thread& closer: closers)
+    {
+        closer.join();
+    }
+}
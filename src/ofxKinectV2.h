@@ -10,6 +10,9 @@
 
 
 #include "ofProtonect.h"
+#include "ofProtonectSyntheticDevice.h"
+#include "ofxKinectV2Pool.h"
+#include "ofxKinectV2TripleBuffer.h"
 #include "ofMain.h"
 
 
@@ -23,6 +26,18 @@ public:
         int freenectId; //don't use this one - this is the index given by freenect2 - but this can change based on order device is plugged in
     };
 
+    /// \brief A reference counted, read only frame.
+    ///
+    /// The frame's buffers go back to the pool once the last handle to it is
+    /// dropped, so holding on to a handle keeps the frame valid without copying.
+    typedef std::shared_ptr<const ofProtonect::FrameSet> FrameSetHandle;
+
+    /// \brief A read only view of a single output of a frame.
+    ///
+    /// A lease shares ownership of the whole frame it points into.
+    template<typename T>
+    using FrameLease = std::shared_ptr<const T>;
+
     ofxKinectV2();
     ~ofxKinectV2();
     
@@ -42,15 +57,81 @@ public:
     /// \returns true if connected successfully.
     bool open(int deviceId = 0, ofProtonect::PacketPipelineType packetPipelineType = ofProtonect::PacketPipelineType::OPENCL, int processingDevice = 0, bool initRGB =true, bool initIr =true, bool initDepth = true, bool registerImages =true, bool usePointCloud = true, bool pointCloudHasFaces = true,  bool pointCloudTexCoords = true);
 
+    /// \brief Open a frame source other than a connected device.
+    ///
+    /// Use this with an ofProtonectSyntheticDevice to run the whole pipeline
+    /// without a sensor.
+    /// \param frameSource The source to read from, ofxKinectV2 takes ownership.
+    /// \returns true if the source was started successfully.
+    bool open(libfreenect2::Freenect2Device* frameSource, bool initRGB = true, bool initIr = true, bool initDepth = true, bool registerImages = true, bool usePointCloud = true, bool pointCloudHasFaces = true, bool pointCloudTexCoords = true);
+
+    /// \brief Play back a recording instead of a connected device.
+    ///
+    /// The directory holds libfreenect2 packet files, see
+    /// ofProtonect::openReplay(). Recorded packets are decoded and processed
+    /// exactly like live ones. No depth frame is dropped, color frames may be.
+    /// \param directory The directory holding the recording.
+    /// \param mode Whether to keep the recorded frame rate.
+    /// \returns true if the recording was opened successfully.
+    bool openReplay(const std::string& directory, ofProtonect::PacketPipelineType packetPipelineType = ofProtonect::PacketPipelineType::OPENCL, ofProtonect::ReplayMode mode = ofProtonect::ReplayMode::REALTIME, int processingDevice = 0, bool initRGB = true, bool initIr = true, bool initDepth = true, bool registerImages = true, bool usePointCloud = true, bool pointCloudHasFaces = true, bool pointCloudTexCoords = true);
+
+    /// \brief Play back a file of decoded frames written by startRecording().
+    ///
+    /// The file is memory mapped, so even long recordings open instantly and
+    /// can be scrubbed through getFrameFile() without loading them.
+    /// \param path The frame file.
+    /// \param mode Whether to keep the recorded frame rate.
+    /// \param loop Start over at the end of the file.
+    /// \returns true if the file was opened successfully.
+    bool openFrameFile(const std::string& path, ofProtonect::ReplayMode mode = ofProtonect::ReplayMode::REALTIME, bool loop = true, bool initRGB = true, bool initIr = true, bool initDepth = true, bool registerImages = true, bool usePointCloud = true, bool pointCloudHasFaces = true, bool pointCloudTexCoords = true);
+
+    /// \returns the frame file being played back, nullptr if there is none.
+    ofProtonectFrameFileReader* getFrameFile();
+
+    /// \brief Record the decoded depth, IR and registered color to a frame file.
+    /// \param recordPointCloud Also record an organized XYZ point cloud.
+    /// \returns true if recording started.
+    bool startRecording(const std::string& path, bool recordPointCloud = false);
+    void stopRecording();
+    bool isRecording() const;
+
     /// \brief Update the Kinect internals.
     void update();
     
     /// \brief Close the connection to the Kinect.
+    ///
+    /// A processing thread waiting for a frame is woken up, so a stalled or
+    /// unplugged device doesn't hold the app up.
     void close();
 
+    /// \brief Close several Kinects at once, each on its own thread.
+    static void closeAll(const std::vector<ofxKinectV2*>& kinects);
+
     /// \returns true if the frame has been updated.
     bool isFrameNew() const;
 
+    /// \returns true if the device stopped delivering frames because its
+    /// streams couldn't be restarted. close() and open() it again then.
+    bool hasFailed() const;
+
+    /// \returns how long each stage of the pipeline took for the recent frames.
+    const ofProtonectTimings& getTimings() const;
+
+    /// \returns the number of decoded frames dropped because too many were held.
+    uint64_t getNumDroppedFrames() const;
+
+    /// \brief Set how many decoded frames of each type may be alive at once.
+    ///
+    /// Every FrameSetHandle or lease kept by the app holds one. Takes effect on
+    /// the next open().
+    void setFramePoolSize(std::size_t size);
+
+    /// \brief Choose whether color and depth frames are waited for together.
+    ///
+    /// With ofProtonect::StreamMode::DEPTH_DRIVEN frames are produced at the
+    /// depth rate and carry the latest color frame. Takes effect on the next open().
+    void setStreamMode(ofProtonect::StreamMode mode);
+
     OF_DEPRECATED_MSG("Use getPixels()", ofPixels getRgbPixels());
 
     /// \returns the RGB pixels.
@@ -63,26 +144,124 @@ public:
     const ofFloatPixels& getRawDepthPixels() const;
 
     /// \returns the depth pixels mapped to a visible range.
+    ///
+    /// Mapped on the processing thread once they have been asked for, only
+    /// remapped here if minDistance or maxDistance changed since.
     const ofPixels& getDepthPixels() const;
 
     /// \returns the raw IR pixels.
     const ofFloatPixels& getRawIRPixels() const;
 
     /// \returns the IR pixels mapped to a visible range.
+    ///
+    /// Mapped on the processing thread once they have been asked for.
     const ofPixels& getIRPixels() const;
 
     /// \returns the distance image. Each pixels is the distance in millimeters.
-    const ofFloatImage& getDistancePixels() const;
+    ///
+    /// The image is only computed once it has been asked for, it is empty
+    /// until the next frame after the first call.
+    const ofFloatPixels& getDistancePixels() const;
 
 	const ofVboMesh& getPointCloud() const;
+
+    /// \returns the point cloud as a 512x424 image, see setOrganizedPointCloud().
+    const ofFloatPixels& getOrganizedPointCloud() const;
+
+    /// \returns the frame all getters currently read from.
+    ///
+    /// When demand driven, call requestOutput() for what is read from it.
+    FrameSetHandle getFrameSet() const;
+
+    /// \returns a lease on the RGB pixels of the current frame.
+    FrameLease<ofPixels> leasePixels() const;
+
+    /// \returns a lease on the registered pixels of the current frame.
+    FrameLease<ofPixels> leaseRegisteredPixels() const;
+
+    /// \returns a lease on the raw depth pixels of the current frame.
+    FrameLease<ofFloatPixels> leaseRawDepthPixels() const;
+
+    /// \returns a lease on the raw IR pixels of the current frame.
+    FrameLease<ofFloatPixels> leaseRawIRPixels() const;
+
+    /// \returns a lease on the point cloud of the current frame.
+    FrameLease<ofVboMesh> leasePointCloud() const;
+
+    /// \returns a lease on the organized point cloud of the current frame.
+    FrameLease<ofFloatPixels> leaseOrganizedPointCloud() const;
     
 	void setPointCloudTransformationMatrix(ofMatrix4x4 _mat);
 
+    /// \brief Also produce the point cloud as a float image of x, y, z (and color) per depth pixel.
+    ///
+    /// Points keep their pixel position, so no faces are needed to find
+    /// neighbours. Disabled by default.
+    void setOrganizedPointCloud(ofProtonect::OrganizedPointCloud mode);
+
+    /// \brief Reduce the point cloud to one vertex per steps x steps block.
+    ///
+    /// By default steps only spaces the faces and every depth pixel stays a vertex.
+    void setPointCloudDecimation(ofProtonectPointCloudKernel::Decimation decimation);
+
+    /// \brief Only keep the points within [minDistance, maxDistance] in the point cloud.
+    ///
+    /// Points outside the range are NaN otherwise, which keeps the point
+    /// cloud organized as one vertex per depth pixel.
+    void setCompactPointCloud(bool compact);
+
+    /// \brief Build the point cloud from depth alone, without colors or texture coordinates.
+    ///
+    /// The point cloud then doesn't need the color stream. Call it before
+    /// open() and pass initRGB and registerImages as false to only start the
+    /// depth stream, so no color gets decoded or registered.
+    void setPointCloudGeometryOnly(bool geometryOnly);
+
+    /// \brief Only compute the outputs whose getters were called in the last
+    /// numFrames frames, see ofProtonect::setDemandDriven().
+    void setDemandDriven(bool demandDriven, uint64_t numFrames = 30);
+
+    /// \brief Keep an output computed that is read through getFrameSet().
+    void requestOutput(ofProtonect::Output output);
+
     /// \brief Get the calulated distance for point x, y in the getRegisteredPixels image.
+    ///
+    /// The distance is in meters, NaN where the depth is invalid. Reads the
+    /// distance image if it is computed, see getDistancePixels(), and
+    /// computes just this pixel from the undistorted depth otherwise.
     float getDistanceAt(std::size_t x, std::size_t y) const;
     
-    /// \brief Get the world X, Y, Z coordinates in millimeters for x, y in getRegisteredPixels image.
+    /// \brief Get the world X, Y, Z coordinates in meters for x, y in getRegisteredPixels image.
+    ///
+    /// These are libfreenect2's camera space coordinates, as from
+    /// Registration::getPointXYZ(). Use getWorldCoordinatesAt() for many pixels.
     glm::vec3 getWorldCoordinateAt(std::size_t x, std::size_t y) const;
+
+    /// \brief Get the world coordinates of many pixels of the getRegisteredPixels image at once.
+    ///
+    /// All coordinates come from the current frame, the one the getters read
+    /// from, so they match getRegisteredPixels() even while new frames arrive.
+    /// \param pixels The pixel positions, x is the column and y the row.
+    /// \param numPixels The number of pixel positions.
+    /// \param coordinates Receives numPixels coordinates in meters, NaN for
+    ///        invalid depth or positions outside the image.
+    /// \returns false if there is no frame yet.
+    bool getWorldCoordinatesAt(const glm::ivec2* pixels, std::size_t numPixels, glm::vec3* coordinates) const;
+
+    /// \brief Get the world coordinates of many pixels of the getRegisteredPixels image at once.
+    /// \param coordinates Receives a coordinate per pixel position.
+    bool getWorldCoordinatesAt(const std::vector<glm::ivec2>& pixels, std::vector<glm::vec3>& coordinates) const;
+
+    /// \brief Get the world coordinates of the pixels selected by a mask.
+    /// \param mask A mask the size of getRegisteredPixels(), every pixel whose
+    ///        first channel isn't 0 is selected.
+    /// \param coordinates Receives the coordinates of the selected pixels, in row-major order.
+    /// \param pixels If not nullptr, receives the positions of the selected pixels.
+    /// \returns false if there is no frame yet or the mask has the wrong size.
+    bool getWorldCoordinatesAt(const ofPixels& mask, std::vector<glm::vec3>& coordinates, std::vector<glm::ivec2>* pixels = nullptr) const;
+
+    /// \brief Get the world coordinates of pixels of a frame held by the app.
+    bool getWorldCoordinatesAt(const FrameSetHandle& frame, const glm::ivec2* pixels, std::size_t numPixels, glm::vec3* coordinates) const;
     
     ofParameterGroup params;
     ofParameter<float> minDistance;
@@ -119,8 +298,13 @@ public:
     void setUsePointCloud(bool _usePointCloud);
     void setUseRegisterImages(bool _registerImages);
     void setIsPointCloudFilled(bool _pointCloudFilled);
+
+    /// \brief Start or stop the color stream while open, see ofProtonect::setStreams().
     void setUseRgb(bool _enableRGB);
+
+    /// \brief Start or stop the depth and IR stream while open, see ofProtonect::setStreams().
     void setUseDepth(bool _enableDepth);
+
     void setUseIr(bool _enableIr);
     void setUseTexCoords(bool _useTexCoords);
 	void setTransformPointCloud(bool _transformPointCloud);
@@ -147,48 +331,35 @@ protected:
     
     void threadedFunction();
 
-    ofPixels pixels;
-    ofPixels registeredPixels;
-    ofFloatPixels rawDepthPixels;
-    ofPixels depthPixels;
-    ofFloatPixels distancePixels;
-	ofVboMesh pointCloud;
-	std::vector<glm::vec3> pcVerts;
-	std::vector<ofDefaultColorType> pcColors;
-	std::vector<ofIndexType> pcIndices;
-	std::vector<glm::vec2> pcTexCoords;
-    ofFloatPixels rawIRPixels;
-    ofPixels irPixels;
+    /// \brief Apply the stream settings of open() and start the thread.
+    bool startKinect(bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces, bool pointCloudTexCoords);
+
+    /// \brief Enable the streams and the registration the outputs of open() need.
+    void setStreamSettings(bool initRGB, bool initIr, bool initDepth, bool registerImages, bool usePointCloud, bool pointCloudHasFaces);
+
+    /// \brief Converted by the getters when the frame's own 8 bit images
+    /// can't be used.
+    mutable ofPixels depthPixels;
+    mutable bool depthPixelsValid = false;
+    mutable float depthPixelsMinDistance = 0;
+    mutable float depthPixelsMaxDistance = 0;
+
+    mutable ofPixels irPixels;
+    mutable bool irPixelsValid = false;
 
-    
-    bool bNewBuffer = false;
     bool bNewFrame = false;
     bool bOpened = false;
 
     mutable ofProtonect protonect;
-    
-    ofPixels pixelsBack;
-    ofPixels pixelsFront;
-    ofPixels registeredPixelsBack;
-    ofPixels registeredPixelsFront;
-    ofFloatPixels rawDepthPixelsBack;
-    ofFloatPixels rawDepthPixelsFront;
-    ofFloatPixels rawIRPixelsBack;
-    ofFloatPixels rawIRPixelsFront;
-    ofFloatPixels distancePixelsFront;
-    ofFloatPixels distancePixelsBack;
-
-	std::vector<glm::vec3> pcVertsFront;
-	std::vector<glm::vec3> pcVertsBack;
-
-	std::vector<ofDefaultColorType> pcColorsFront;
-	std::vector<ofDefaultColorType> pcColorsBack;
-
-	std::vector<ofIndexType> pcIndicesFront;
-	std::vector<ofIndexType> pcIndicesBack;
-
-	std::vector<glm::vec2> pcTexCoordsFront;
-	std::vector<glm::vec2> pcTexCoordsBack;
+
+    /// \brief Frames filled by threadedFunction().
+    ofxKinectV2Pool<ofProtonect::FrameSet> framePool;
+
+    /// \brief Published by threadedFunction(), picked up by update().
+    ofxKinectV2TripleBuffer<FrameSetHandle> frameSets;
+
+    /// \brief The frame the getters read from, replaced by update().
+    FrameSetHandle frameSet;
 
     int lastFrameNo = -1;
 };
@@ -0,0 +1,100 @@
+//
+//  ofxKinectV2Pool.h
+//
+//  Recycles frame buffers between the Kinect thread and its consumers.
+//
+
+
+#pragma once
+
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+/// \brief A thread safe pool of reusable objects.
+///
+/// acquire() hands out a shared_ptr that puts the object back into the pool
+/// when the last copy of it is dropped, so buffers allocated for one frame are
+/// reused by the following ones. Objects released after the pool itself is
+/// gone are simply deleted.
+template<typename T>
+class ofxKinectV2Pool
+{
+public:
+    ofxKinectV2Pool(): state(std::make_shared<State>())
+    {
+    }
+
+    /// \brief Set a function that runs on every object put back into the pool.
+    ///
+    /// Use it to release what an idle object shouldn't hold on to. Set it
+    /// before the first acquire().
+    void setOnRelease(std::function<void(T&)> onRelease)
+    {
+        state->onRelease = std::move(onRelease);
+    }
+
+    /// \returns a free object, or a new one if all of them are in use.
+    std::shared_ptr<T> acquire()
+    {
+        std::unique_ptr<T> item;
+
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+
+            if (!state->items.empty())
+            {
+                item = std::move(state->items.back());
+                state->items.pop_back();
+            }
+        }
+
+        if (!item)
+        {
+            item.reset(new T());
+        }
+
+        std::weak_ptr<State> weakState = state;
+
+        return std::shared_ptr<T>(item.release(), [weakState](T* released)
+        {
+            std::shared_ptr<State> owner = weakState.lock();
+
+            if (owner)
+            {
+                // Outside the lock, releasing may take other locks.
+                if (owner->onRelease)
+                {
+                    owner->onRelease(*released);
+                }
+
+                std::unique_lock<std::mutex> lock(owner->mutex);
+                owner->items.emplace_back(released);
+            }
+            else
+            {
+                delete released;
+            }
+        });
+    }
+
+    /// \returns the number of objects waiting to be reused.
+    std::size_t getNumFree() const
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        return state->items.size();
+    }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<T>> items;
+        std::function<void(T&)> onRelease;
+    };
+
+    std::shared_ptr<State> state;
+};
@@ -0,0 +1,92 @@
+//
+//  ofxKinectV2TripleBuffer.h
+//
+//  Lock-free hand off between the Kinect thread and the app thread.
+//
+
+
+#pragma once
+
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+/// \brief A single producer / single consumer triple buffer.
+///
+/// One slot is owned by the producer, one by the consumer and the third one
+/// holds the latest published frame. publish() and acquire() only exchange
+/// slot indices, so a hand off never copies the frame and never blocks.
+template<typename T>
+class ofxKinectV2TripleBuffer
+{
+public:
+    ofxKinectV2TripleBuffer()
+    {
+        reset();
+    }
+
+    /// \brief Forget any published frame.
+    ///
+    /// Only call this while neither the producer nor the consumer is running.
+    void reset()
+    {
+        buffers.fill(T());
+        writeIndex = 0;
+        readIndex = 1;
+        latest.store(2, std::memory_order_relaxed);
+    }
+
+    /// \returns the slot the producer is allowed to write to.
+    T& getWriteBuffer()
+    {
+        return buffers[writeIndex];
+    }
+
+    /// \brief Publish the write slot as the latest frame.
+    ///
+    /// The producer gets back whichever slot is not held by the consumer. If
+    /// the consumer didn't pick up the previous frame, that frame is dropped.
+    void publish()
+    {
+        writeIndex = latest.exchange(writeIndex | DIRTY, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    /// \brief Take the latest published frame, if there is a new one.
+    /// \returns true if getReadBuffer() now holds a new frame.
+    bool acquire()
+    {
+        if ((latest.load(std::memory_order_relaxed) & DIRTY) == 0)
+        {
+            return false;
+        }
+
+        readIndex = latest.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    /// \returns the slot currently held by the consumer.
+    T& getReadBuffer()
+    {
+        return buffers[readIndex];
+    }
+
+    /// \returns the slot currently held by the consumer.
+    const T& getReadBuffer() const
+    {
+        return buffers[readIndex];
+    }
+
+private:
+    enum : uint8_t
+    {
+        INDEX_MASK = 0x3,
+        DIRTY = 0x4
+    };
+
+    std::array<T, 3> buffers;
+    uint8_t writeIndex;
+    uint8_t readIndex;
+    std::atomic<uint8_t> latest;
+};